@@ -27,16 +27,397 @@
 #include "kernel/sigtools.h"
 #include "kernel/log.h"
 #include "kernel/satgen.h"
+#include "libs/fst/fstapi.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <algorithm>
 #include <errno.h>
 #include <string.h>
 #include <unordered_map>
+#include <queue>
+#ifdef YOSYS_ENABLE_THREADS
+#include <thread>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 USING_YOSYS_NAMESPACE
 PRIVATE_NAMESPACE_BEGIN
 
+// Model values as two planes of 64 bit words: the value of each model expression and,
+// with undef modeling, whether the expression is undef.
+struct SatModel
+{
+	int width = 0;
+	std::vector<uint64_t> value, undef;
+
+	// load a solver result of `count` model expressions, the undef half comes second
+	void load(const std::vector<bool> &values, int count, bool has_undef)
+	{
+		width = has_undef ? count / 2 : count;
+		value.assign((width + 63) / 64, 0);
+		undef.assign((width + 63) / 64, 0);
+		for (int i = 0; i < width; i++) {
+			if (values[i])
+				value[i / 64] |= uint64_t(1) << (i % 64);
+			if (has_undef && values[width + i])
+				undef[i / 64] |= uint64_t(1) << (i % 64);
+		}
+	}
+
+	bool get(int i) const
+	{
+		log_assert(i >= 0 && i < width);
+		return (value[i / 64] >> (i % 64)) & 1;
+	}
+
+	bool get_undef(int i) const
+	{
+		log_assert(i >= 0 && i < width);
+		return (undef[i / 64] >> (i % 64)) & 1;
+	}
+
+	void set_undef(int i, bool v)
+	{
+		log_assert(i >= 0 && i < width);
+		if (v)
+			undef[i / 64] |= uint64_t(1) << (i % 64);
+		else
+			undef[i / 64] &= ~(uint64_t(1) << (i % 64));
+	}
+
+	// copy `count` bits starting at `offset` out of a plane, LSB first
+	static void extract(const std::vector<uint64_t> &plane, int offset, int count, std::vector<uint64_t> &words)
+	{
+		words.assign((count + 63) / 64, 0);
+		for (int w = 0; w < GetSize(words); w++) {
+			int idx = (offset + 64*w) / 64, shift = (offset + 64*w) % 64;
+			uint64_t bits = plane[idx] >> shift;
+			if (shift != 0 && idx + 1 < GetSize(plane))
+				bits |= plane[idx + 1] << (64 - shift);
+			words[w] = bits;
+		}
+		if (count % 64 != 0)
+			words.back() &= (uint64_t(1) << (count % 64)) - 1;
+	}
+
+	void swap(SatModel &other)
+	{
+		std::swap(width, other.width);
+		value.swap(other.value);
+		undef.swap(other.undef);
+	}
+};
+
+// 256 simulation lanes, using AVX2 instructions where available
+struct alignas(32) SimWord
+{
+	uint64_t w[4];
+
+	SimWord() : w{0, 0, 0, 0} { }
+
+	bool lane(int i) const { return (w[i / 64] >> (i % 64)) & 1; }
+
+#ifdef __AVX2__
+	SimWord(__m256i v) { _mm256_store_si256((__m256i*)w, v); }
+	__m256i m() const { return _mm256_load_si256((const __m256i*)w); }
+
+	SimWord operator&(const SimWord &other) const { return _mm256_and_si256(m(), other.m()); }
+	SimWord operator|(const SimWord &other) const { return _mm256_or_si256(m(), other.m()); }
+	SimWord operator^(const SimWord &other) const { return _mm256_xor_si256(m(), other.m()); }
+	SimWord operator~() const { return _mm256_xor_si256(m(), _mm256_set1_epi64x(-1)); }
+	bool is_zero() const { return _mm256_testz_si256(m(), m()); }
+#else
+	SimWord operator&(const SimWord &other) const { SimWord r; for (int i = 0; i < 4; i++) r.w[i] = w[i] & other.w[i]; return r; }
+	SimWord operator|(const SimWord &other) const { SimWord r; for (int i = 0; i < 4; i++) r.w[i] = w[i] | other.w[i]; return r; }
+	SimWord operator^(const SimWord &other) const { SimWord r; for (int i = 0; i < 4; i++) r.w[i] = w[i] ^ other.w[i]; return r; }
+	SimWord operator~() const { SimWord r; for (int i = 0; i < 4; i++) r.w[i] = ~w[i]; return r; }
+	bool is_zero() const { return (w[0] | w[1] | w[2] | w[3]) == 0; }
+#endif
+};
+
+// Levelized bit-parallel three-valued simulator for the imported cells. Each signal bit
+// has a value and a defined plane with one pattern per bit of a Word (uint64_t or SimWord),
+// undef bits have both planes clear. The gates selected by select_cone() are copied into
+// flat arrays in evaluation order. Only single-bit gates, bitwise coarse cells and plain
+// flip-flops are supported.
+template<typename Word>
+struct SatSimT
+{
+	enum GateType { G_BUF, G_NOT, G_AND, G_NAND, G_OR, G_NOR, G_XOR, G_XNOR, G_ANDNOT, G_ORNOT, G_MUX };
+
+	struct Gate {
+		int type, y, a, b, s;
+	};
+
+	idict<RTLIL::SigBit> bits;
+	std::vector<Gate> gates;
+	std::vector<std::pair<int, int>> dffs;
+	std::vector<bool> driven, is_state;
+	std::string error;
+
+	// the part of the netlist selected by select_cone(), gates in evaluation order. unused
+	// b and s operands point to the a operand so that eval() can load them unconditionally
+	std::vector<int> act_type, act_y, act_a, act_b, act_s;
+	std::vector<int> active_dffs, cone_inputs;
+
+	std::vector<Word> val, def;
+
+	void add_gate(int type, const RTLIL::SigSpec &y, const RTLIL::SigSpec &a, const RTLIL::SigSpec &b, const RTLIL::SigSpec &s)
+	{
+		for (int i = 0; i < GetSize(y); i++) {
+			Gate g;
+			g.type = type;
+			g.y = bits(y[i]);
+			g.a = bits(a[i]);
+			g.b = GetSize(b) ? bits(b[i]) : -1;
+			g.s = GetSize(s) ? bits(s[0]) : -1;
+			gates.push_back(g);
+		}
+	}
+
+	bool compile(const std::vector<RTLIL::Cell*> &cells, const SigMap &sigmap)
+	{
+		static dict<RTLIL::IdString, int> fine_types = {
+			{ID($_BUF_), G_BUF}, {ID($_NOT_), G_NOT}, {ID($_AND_), G_AND}, {ID($_NAND_), G_NAND},
+			{ID($_OR_), G_OR}, {ID($_NOR_), G_NOR}, {ID($_XOR_), G_XOR}, {ID($_XNOR_), G_XNOR},
+			{ID($_ANDNOT_), G_ANDNOT}, {ID($_ORNOT_), G_ORNOT}, {ID($_MUX_), G_MUX}
+		};
+		static dict<RTLIL::IdString, int> coarse_types = {
+			{ID($pos), G_BUF}, {ID($not), G_NOT}, {ID($and), G_AND}, {ID($or), G_OR},
+			{ID($xor), G_XOR}, {ID($xnor), G_XNOR}, {ID($mux), G_MUX}
+		};
+
+		for (auto cell : cells)
+		{
+			if (cell->type.in(ID($assert), ID($assume), ID($cover), ID($live), ID($fair)))
+				continue;
+
+			if (cell->type.in(ID($dff), ID($_DFF_P_), ID($_DFF_N_), ID($anyinit))) {
+				RTLIL::SigSpec d = sigmap(cell->getPort(ID::D)), q = sigmap(cell->getPort(ID::Q));
+				for (int i = 0; i < GetSize(q); i++)
+					dffs.push_back(std::make_pair(bits(d[i]), bits(q[i])));
+				continue;
+			}
+
+			int type;
+			if (fine_types.count(cell->type))
+				type = fine_types.at(cell->type);
+			else if (coarse_types.count(cell->type))
+				type = coarse_types.at(cell->type);
+			else {
+				error = stringf("unsupported cell type %s", log_id(cell->type));
+				return false;
+			}
+
+			RTLIL::SigSpec y = sigmap(cell->getPort(ID::Y)), a = sigmap(cell->getPort(ID::A)), b, s;
+			if (cell->hasPort(ID::B))
+				b = sigmap(cell->getPort(ID::B));
+			if (cell->hasPort(ID::S))
+				s = sigmap(cell->getPort(ID::S));
+			if (GetSize(a) != GetSize(y) || (GetSize(b) && GetSize(b) != GetSize(y)) || GetSize(s) > 1) {
+				error = stringf("cell %s has mismatching port widths", log_id(cell));
+				return false;
+			}
+			add_gate(type, y, a, b, s);
+		}
+
+		// levelize the gates, flip-flop outputs count as primary inputs
+		int nbits = GetSize(bits);
+		std::vector<int> driver(nbits, -1);
+		driven.assign(nbits, false);
+		is_state.assign(nbits, false);
+		for (int gi = 0; gi < GetSize(gates); gi++) {
+			int y = gates[gi].y;
+			if (bits[y].wire == NULL) {
+				error = stringf("a cell output is connected to the constant %s", log_signal(bits[y]));
+				return false;
+			}
+			if (driven[y]) {
+				error = stringf("signal %s has more than one driver", log_signal(bits[y]));
+				return false;
+			}
+			driven[y] = true, driver[y] = gi;
+		}
+		for (auto &it : dffs) {
+			if (bits[it.second].wire == NULL) {
+				error = stringf("a flip-flop output is connected to the constant %s", log_signal(bits[it.second]));
+				return false;
+			}
+			if (driven[it.second]) {
+				error = stringf("signal %s has more than one driver", log_signal(bits[it.second]));
+				return false;
+			}
+			driven[it.second] = true, is_state[it.second] = true;
+		}
+
+		std::vector<int> pending(GetSize(gates), 0);
+		std::vector<std::vector<int>> users(GetSize(gates));
+		for (int gi = 0; gi < GetSize(gates); gi++)
+			for (int in : {gates[gi].a, gates[gi].b, gates[gi].s})
+				if (in >= 0 && driver[in] >= 0) {
+					users[driver[in]].push_back(gi);
+					pending[gi]++;
+				}
+
+		std::vector<int> order;
+		for (int gi = 0; gi < GetSize(gates); gi++)
+			if (pending[gi] == 0)
+				order.push_back(gi);
+		for (int i = 0; i < GetSize(order); i++)
+			for (int gi : users[order[i]])
+				if (--pending[gi] == 0)
+					order.push_back(gi);
+
+		if (GetSize(order) != GetSize(gates)) {
+			error = "design contains a combinational loop";
+			return false;
+		}
+
+		std::vector<Gate> sorted_gates;
+		for (int gi : order)
+			sorted_gates.push_back(gates[gi]);
+		gates.swap(sorted_gates);
+		return true;
+	}
+
+	// Restrict evaluation to the transitive fanin of the given bits (across flip-flops).
+	// cone_inputs are the undriven bits of the cone plus the reached flip-flop outputs.
+	void select_cone(const std::vector<int> &roots)
+	{
+		int nbits = GetSize(bits);
+		driven.resize(nbits, false);
+		is_state.resize(nbits, false);
+
+		std::vector<int> gate_of(nbits, -1), dff_of(nbits, -1);
+		for (int gi = 0; gi < GetSize(gates); gi++)
+			gate_of[gates[gi].y] = gi;
+		for (int di = 0; di < GetSize(dffs); di++)
+			dff_of[dffs[di].second] = di;
+
+		std::vector<bool> visited(nbits), gate_used(GetSize(gates));
+		std::vector<int> queue;
+		for (int id : roots)
+			if (!visited[id])
+				visited[id] = true, queue.push_back(id);
+
+		active_dffs.clear();
+		cone_inputs.clear();
+		for (int qi = 0; qi < GetSize(queue); qi++)
+		{
+			int id = queue[qi];
+			std::vector<int> next;
+			if (gate_of[id] >= 0) {
+				const Gate &g = gates[gate_of[id]];
+				gate_used[gate_of[id]] = true;
+				next = {g.a, g.b, g.s};
+			} else if (dff_of[id] >= 0) {
+				active_dffs.push_back(dff_of[id]);
+				cone_inputs.push_back(id);
+				next = {dffs[dff_of[id]].first};
+			} else if (bits[id].wire != NULL)
+				cone_inputs.push_back(id);
+			for (int in : next)
+				if (in >= 0 && !visited[in])
+					visited[in] = true, queue.push_back(in);
+		}
+
+		act_type.clear(), act_y.clear(), act_a.clear(), act_b.clear(), act_s.clear();
+		for (int gi = 0; gi < GetSize(gates); gi++)
+			if (gate_used[gi]) {
+				const Gate &g = gates[gi];
+				act_type.push_back(g.type);
+				act_y.push_back(g.y);
+				act_a.push_back(g.a);
+				act_b.push_back(g.b >= 0 ? g.b : g.a);
+				act_s.push_back(g.s >= 0 ? g.s : g.a);
+			}
+
+		val.assign(nbits, Word());
+		def.assign(nbits, Word());
+		for (int id = 0; id < nbits; id++)
+			if (bits[id].wire == NULL) {
+				if (bits[id].data == RTLIL::State::S0 || bits[id].data == RTLIL::State::S1)
+					def[id] = ~Word();
+				if (bits[id].data == RTLIL::State::S1)
+					val[id] = ~Word();
+			}
+	}
+
+	void eval()
+	{
+		int n = GetSize(act_type);
+		const int *type = act_type.data(), *y = act_y.data(), *a = act_a.data(), *b = act_b.data(), *s = act_s.data();
+		Word *v = val.data(), *d = def.data();
+
+		for (int i = 0; i < n; i++)
+		{
+			Word av = v[a[i]], ad = d[a[i]], bv = v[b[i]], bd = d[b[i]];
+			Word yv = Word(), yd = Word();
+
+			if (type[i] == G_ANDNOT || type[i] == G_ORNOT)
+				bv = ~bv & bd;
+
+			switch (type[i])
+			{
+			case G_BUF:
+				yv = av, yd = ad;
+				break;
+			case G_NOT:
+				yv = ~av & ad, yd = ad;
+				break;
+			case G_AND:
+			case G_NAND:
+			case G_ANDNOT:
+				yv = av & bv, yd = yv | (ad & ~av) | (bd & ~bv);
+				break;
+			case G_OR:
+			case G_NOR:
+			case G_ORNOT:
+				yv = av | bv, yd = yv | (ad & ~av & bd & ~bv);
+				break;
+			case G_XOR:
+			case G_XNOR:
+				yd = ad & bd, yv = (av ^ bv) & yd;
+				break;
+			case G_MUX: {
+				Word sv = v[s[i]], sd = d[s[i]];
+				yd = (sd & sv & bd) | (sd & ~sv & ad) | (~sd & ad & bd & ~(av ^ bv));
+				yv = ((sd & sv & bv) | (sd & ~sv & av) | (~sd & av & bv)) & yd;
+				break;
+			}
+			}
+
+			if (type[i] == G_NAND || type[i] == G_NOR || type[i] == G_XNOR)
+				yv = ~yv & yd;
+
+			v[y[i]] = yv, d[y[i]] = yd;
+		}
+	}
+
+	// move the flip-flop inputs of the current step to their outputs for the next step
+	void save_state(std::vector<Word> &state_val, std::vector<Word> &state_def)
+	{
+		state_val.resize(GetSize(active_dffs));
+		state_def.resize(GetSize(active_dffs));
+		for (int i = 0; i < GetSize(active_dffs); i++) {
+			int d = dffs[active_dffs[i]].first;
+			state_val[i] = val[d], state_def[i] = def[d];
+		}
+	}
+
+	void load_state(const std::vector<Word> &state_val, const std::vector<Word> &state_def)
+	{
+		for (int i = 0; i < GetSize(active_dffs); i++) {
+			int q = dffs[active_dffs[i]].second;
+			val[q] = state_val[i], def[q] = state_def[i];
+		}
+	}
+};
+
+typedef SatSimT<uint64_t> SatSim;
+
 struct SatHelper
 {
 	RTLIL::Design *design;
@@ -49,20 +430,68 @@ struct SatHelper
 	SatGen satgen;
 	std::vector<int> fuckingX;
 	std::vector<int> fuckingL;
+	pool<int> x_lits;
+	// scratch literal vectors reused by setup_proof() and maximize_undefs(), cleared but
+	// not freed between uses (ezSAT takes std::vector, so they can't be plain spans)
+	std::vector<int> proof_scratch, must_undef_scratch, maybe_undef_scratch;
 	// additional constraints
 	std::vector<std::pair<std::string, std::string>> sets, prove, prove_x, sets_init;
 	std::map<int, std::vector<std::pair<std::string, std::string>>> sets_at;
 	std::map<int, std::vector<std::string>> unsets_at;
 	bool prove_asserts, set_assumes;
+	// selectors of the retractable constraints that are currently active
+	std::vector<int> active_selectors;
+	// -unsat-core: selector literal and description of each user constraint
+	bool track_core = false;
+	std::vector<int> core_selectors;
+	std::vector<std::string> core_descriptions;
 	// undef constraints
 	bool enable_undef, set_init_def, set_init_undef, set_init_zero, ignore_unknown_cells;
 	std::vector<std::string> sets_def, sets_any_undef, sets_all_undef;
 	std::map<int, std::vector<std::string>> sets_def_at, sets_any_undef_at, sets_all_undef_at;
 
+	// -hier: CNF of a submodule, encoded once and instantiated per cell by renaming.
+	// port_vars holds the CNF variable of each port bit (negative if inverted), all other
+	// variables are fresh in every instance. The flip-flops of the module and of its own
+	// submodules are cut: state_q/state_d are the variables of their Q and D bits, which
+	// instantiate() maps to the state literals of the time step and the next time step.
+	struct HierTemplate {
+		std::vector<RTLIL::IdString> ports;
+		std::vector<std::vector<int>> port_vars, port_undef_vars;
+		std::vector<int> state_q, state_d, state_q_undef, state_d_undef;
+		std::vector<RTLIL::State> state_init;
+		std::vector<std::vector<int>> cnf;
+		int num_vars = 0;
+	};
+	// flip-flop state collected while a template is built, as literals of its solver
+	struct HierStateLits {
+		std::vector<int> q, d, q_undef, d_undef;
+		std::vector<RTLIL::State> init;
+	};
+	bool hier = false, hier_comb_only = false;
+	std::map<RTLIL::IdString, HierTemplate> hier_templates;
+	pool<RTLIL::IdString> hier_building;
+	// value and undef literal of each submodule state bit, by (cell, state index, time step)
+	std::map<std::tuple<RTLIL::Cell*, int, int>, std::pair<int, int>> hier_state;
+
+	// -threads: number of encoder workers, and the bit table and CNF cached by import_parallel()
+	struct ImportGate {
+		int type, y, a, b, s;
+	};
+	int threads = 1;
+	idict<RTLIL::SigBit> par_bits;
+	std::vector<std::vector<int>> par_cnf;
+	int par_num_cells = -1;
+
 	// model variables
 	std::vector<std::string> shows;
+	std::string model_format = "text";
 	SigPool show_signal_pool;
-	SigSet<RTLIL::Cell*> show_drivers;
+	pool<RTLIL::Cell*> show_driver_cells;
+
+	// time steps whose $initstate cells are driven by the given literal instead of a constant,
+	// the PDR and ITP engines use this to turn "initial frame" into an extra state bit
+	std::map<int, int> initstate_lits;
 	int max_timestep, timeout;
 	bool gotTimeout;
 
@@ -92,6 +521,465 @@ struct SatHelper
 				log_cmd_error("Bit %d of %s is undef but option -enable_undef is missing!\n", int(i), log_signal(sig));
 	}
 
+	const HierTemplate &get_template(RTLIL::Module *mod)
+	{
+		auto it = hier_templates.find(mod->name);
+		if (it != hier_templates.end())
+			return it->second;
+
+		if (hier_building.count(mod->name))
+			log_cmd_error("Module %s instantiates itself, recursive hierarchies are not supported by -hier.\n", log_id(mod));
+		hier_building.insert(mod->name);
+
+		// instances of encoded modules are cells like any other for find_cone_leaves()
+		ct.setup_module(mod);
+
+		ezSatPtr tmp_ez;
+		SigMap tmp_sigmap(mod);
+		SatGen tmp_satgen(tmp_ez.get(), &tmp_sigmap);
+		tmp_satgen.model_undef = enable_undef;
+		tmp_satgen.def_formal = satgen.def_formal;
+		tmp_satgen.ignore_div_by_zero = satgen.ignore_div_by_zero;
+
+		HierStateLits state;
+		std::vector<RTLIL::Cell*> ff_cells;
+		for (auto cell : mod->cells())
+		{
+			RTLIL::Module *submod = design->module(cell->type);
+			if (submod != nullptr && !submod->get_blackbox_attribute()) {
+				instantiate(tmp_ez.get(), tmp_satgen, cell, -1, &state);
+				continue;
+			}
+			if (cell->type.in(ID($dff), ID($ff), ID($_DFF_P_), ID($_DFF_N_), ID($_FF_))) {
+				ff_cells.push_back(cell);
+				continue;
+			}
+			if (RTLIL::builtin_ff_cell_types().count(cell->type) || cell->type.begins_with("$mem") ||
+					cell->type.in(ID($assert), ID($assume), ID($cover), ID($live), ID($fair), ID($initstate),
+					ID($anyconst), ID($anyseq), ID($allconst), ID($allseq)))
+				log_cmd_error("Cell %s (type %s) in module %s is not supported by -hier, the only sequential cells\n"
+						"allowed in submodules are $dff, $ff, $_DFF_P_, $_DFF_N_ and $_FF_.\n",
+						log_id(cell), log_id(cell->type), log_id(mod));
+			if (!tmp_satgen.importCell(cell, -1))
+				log_cmd_error("Failed to import cell %s (type %s) in module %s to SAT database.\n",
+						log_id(cell), log_id(cell->type), log_id(mod));
+		}
+
+		dict<RTLIL::SigBit, RTLIL::State> init_bits;
+		for (auto wire : mod->wires())
+			if (wire->attributes.count(ID::init)) {
+				RTLIL::SigSpec sig = tmp_sigmap(wire);
+				RTLIL::Const init = wire->attributes.at(ID::init);
+				for (int i = 0; i < GetSize(sig) && i < GetSize(init); i++)
+					init_bits[sig[i]] = init[i];
+			}
+
+		for (auto cell : ff_cells) {
+			RTLIL::SigSpec q = cell->getPort(ID::Q), d = cell->getPort(ID::D);
+			for (int lit : tmp_satgen.importSigSpec(q, -1))
+				state.q.push_back(lit);
+			for (int lit : tmp_satgen.importSigSpec(d, -1))
+				state.d.push_back(lit);
+			if (enable_undef) {
+				for (int lit : tmp_satgen.importUndefSigSpec(q, -1))
+					state.q_undef.push_back(lit);
+				for (int lit : tmp_satgen.importUndefSigSpec(d, -1))
+					state.d_undef.push_back(lit);
+			}
+			for (auto bit : tmp_sigmap(q))
+				state.init.push_back(init_bits.count(bit) ? init_bits.at(bit) : RTLIL::State::Sx);
+		}
+
+		if (hier_comb_only && !state.q.empty())
+			log_cmd_error("Module %s has flip-flops, sequential submodules can't be used with -hier and -tempinduct, -pdr or -itp.\n", log_id(mod));
+
+		HierTemplate tpl;
+		for (int lit : state.q)
+			tpl.state_q.push_back(tmp_ez->bind(lit));
+		for (int lit : state.d)
+			tpl.state_d.push_back(tmp_ez->bind(lit));
+		for (int lit : state.q_undef)
+			tpl.state_q_undef.push_back(tmp_ez->bind(lit));
+		for (int lit : state.d_undef)
+			tpl.state_d_undef.push_back(tmp_ez->bind(lit));
+		tpl.state_init = state.init;
+
+		for (auto port : mod->ports) {
+			RTLIL::Wire *wire = mod->wire(port);
+			tpl.ports.push_back(port);
+			tpl.port_vars.push_back(std::vector<int>());
+			tpl.port_undef_vars.push_back(std::vector<int>());
+			for (int lit : tmp_satgen.importSigSpec(wire, -1))
+				tpl.port_vars.back().push_back(tmp_ez->bind(lit));
+			if (enable_undef)
+				for (int lit : tmp_satgen.importUndefSigSpec(wire, -1))
+					tpl.port_undef_vars.back().push_back(tmp_ez->bind(lit));
+		}
+		tmp_ez->consumeCnf(tpl.cnf);
+		tpl.num_vars = tmp_ez->numCnfVariables();
+
+		log("Encoded module %s for -hier: %d variables, %d clauses, %d state bits.\n", log_id(mod), tpl.num_vars,
+				GetSize(tpl.cnf), GetSize(tpl.state_q));
+		hier_building.erase(mod->name);
+		return hier_templates[mod->name] = tpl;
+	}
+
+	// Add a CNF from another solver instance to `target`. The variables in `var_map` are
+	// replaced by the given literals (a negative variable by the inverted literal), all other
+	// variables by fresh literals.
+	static void add_renamed_cnf(ezSAT *target, const std::vector<std::vector<int>> &cnf, int num_vars, const std::vector<std::pair<int, int>> &var_map)
+	{
+		std::vector<int> var_lits(num_vars + 1, 0);
+		for (auto it : var_map) {
+			int var = it.first, lit = it.second;
+			if (var < 0)
+				var = -var, lit = target->NOT(lit);
+			if (var_lits[var] == 0)
+				var_lits[var] = lit;
+			else
+				target->assume(target->IFF(var_lits[var], lit));
+		}
+
+		for (int var = 1; var <= num_vars; var++)
+			if (var_lits[var] == 0)
+				var_lits[var] = target->literal();
+
+		std::vector<int> clause;
+		for (auto &cnf_clause : cnf) {
+			clause.clear();
+			for (int lit : cnf_clause)
+				clause.push_back(lit > 0 ? var_lits[lit] : target->NOT(var_lits[-lit]));
+			target->assume(target->expression(ezSAT::OpOr, clause));
+		}
+	}
+
+	// the literals of state bit `index` of the instance `cell` at a time step, constrained by
+	// the init attributes, -set-init-zero/-def/-undef in the first time step
+	std::pair<int, int> hier_state_lits(RTLIL::Cell *cell, const HierTemplate &tpl, int index, int timestep)
+	{
+		auto key = std::make_tuple(cell, index, timestep);
+		auto it = hier_state.find(key);
+		if (it != hier_state.end())
+			return it->second;
+
+		int lit = ez->literal(), undef = enable_undef ? ez->literal() : 0;
+		if (timestep == 1) {
+			RTLIL::State init = tpl.state_init[index];
+			if (init != RTLIL::State::S0 && init != RTLIL::State::S1 && set_init_zero)
+				init = RTLIL::State::S0;
+			if (init == RTLIL::State::S0 || init == RTLIL::State::S1) {
+				ez->assume(init == RTLIL::State::S1 ? lit : ez->NOT(lit));
+				if (enable_undef)
+					ez->assume(ez->NOT(undef));
+			} else if (enable_undef && set_init_undef)
+				ez->assume(undef);
+			else if (enable_undef && set_init_def)
+				ez->assume(ez->NOT(undef));
+		}
+		return hier_state[key] = std::make_pair(lit, undef);
+	}
+
+	// Instantiate the template of the module of `cell` in the given solver. While a template
+	// is built, `state` collects the state of the instance for the enclosing template. Else
+	// the state is connected across time steps (free at timestep -1).
+	void instantiate(ezSAT *target, SatGen &target_satgen, RTLIL::Cell *cell, int timestep, HierStateLits *state = nullptr)
+	{
+		RTLIL::Module *mod = design->module(cell->type);
+		const HierTemplate &tpl = get_template(mod);
+		std::vector<std::pair<int, int>> var_map;
+
+		for (int pi = 0; pi < GetSize(tpl.ports); pi++)
+		{
+			if (!cell->hasPort(tpl.ports[pi]))
+				continue;
+			RTLIL::SigSpec sig = cell->getPort(tpl.ports[pi]);
+			if (GetSize(sig) != GetSize(tpl.port_vars[pi]))
+				log_cmd_error("Port %s of cell %s has %d bits, but module %s expects %d.\n", log_id(tpl.ports[pi]),
+						log_id(cell), GetSize(sig), log_id(mod), GetSize(tpl.port_vars[pi]));
+
+			std::vector<int> lits = target_satgen.importSigSpec(sig, timestep);
+			for (int i = 0; i < GetSize(lits); i++)
+				var_map.push_back(std::make_pair(tpl.port_vars[pi][i], lits[i]));
+			if (enable_undef) {
+				std::vector<int> undef_lits = target_satgen.importUndefSigSpec(sig, timestep);
+				for (int i = 0; i < GetSize(undef_lits); i++)
+					var_map.push_back(std::make_pair(tpl.port_undef_vars[pi][i], undef_lits[i]));
+			}
+		}
+
+		for (int i = 0; i < GetSize(tpl.state_q); i++)
+		{
+			int q, d, q_undef = 0, d_undef = 0;
+			if (state != nullptr) {
+				q = target->literal(), d = target->literal();
+				if (enable_undef)
+					q_undef = target->literal(), d_undef = target->literal();
+				state->q.push_back(q), state->d.push_back(d);
+				if (enable_undef)
+					state->q_undef.push_back(q_undef), state->d_undef.push_back(d_undef);
+				state->init.push_back(tpl.state_init[i]);
+			} else if (timestep > 0) {
+				log_assert(target == ez.get());
+				std::tie(q, q_undef) = hier_state_lits(cell, tpl, i, timestep);
+				std::tie(d, d_undef) = hier_state_lits(cell, tpl, i, timestep + 1);
+			} else
+				continue;
+
+			var_map.push_back(std::make_pair(tpl.state_q[i], q));
+			var_map.push_back(std::make_pair(tpl.state_d[i], d));
+			if (enable_undef) {
+				var_map.push_back(std::make_pair(tpl.state_q_undef[i], q_undef));
+				var_map.push_back(std::make_pair(tpl.state_d_undef[i], d_undef));
+			}
+		}
+
+		add_renamed_cnf(target, tpl.cnf, tpl.num_vars, var_map);
+	}
+
+	// -threads: the single-bit gates and bitwise coarse cells supported by the encoder, with
+	// the gate types of SatSim. All ports must have the width of Y (S one bit) and constant
+	// inputs must be 0 or 1, then the clauses are those SatGen creates without -enable_undef.
+	bool parallel_gate(RTLIL::Cell *cell, int &type)
+	{
+		static dict<RTLIL::IdString, int> gate_types = {
+			{ID($_BUF_), SatSim::G_BUF}, {ID($_NOT_), SatSim::G_NOT}, {ID($_AND_), SatSim::G_AND}, {ID($_NAND_), SatSim::G_NAND},
+			{ID($_OR_), SatSim::G_OR}, {ID($_NOR_), SatSim::G_NOR}, {ID($_XOR_), SatSim::G_XOR}, {ID($_XNOR_), SatSim::G_XNOR},
+			{ID($_ANDNOT_), SatSim::G_ANDNOT}, {ID($_ORNOT_), SatSim::G_ORNOT}, {ID($_MUX_), SatSim::G_MUX},
+			{ID($pos), SatSim::G_BUF}, {ID($not), SatSim::G_NOT}, {ID($and), SatSim::G_AND}, {ID($or), SatSim::G_OR},
+			{ID($xor), SatSim::G_XOR}, {ID($xnor), SatSim::G_XNOR}, {ID($mux), SatSim::G_MUX}
+		};
+
+		auto it = gate_types.find(cell->type);
+		if (it == gate_types.end())
+			return false;
+		type = it->second;
+
+		int width = GetSize(cell->getPort(ID::Y));
+		for (auto &conn : cell->connections()) {
+			if (GetSize(conn.second) != (conn.first == ID::S ? 1 : width))
+				return false;
+			for (auto bit : sigmap(conn.second))
+				if (bit.wire == NULL && bit.data != RTLIL::State::S0 && bit.data != RTLIL::State::S1)
+					return false;
+		}
+		return true;
+	}
+
+	// Encode gates [begin, end) as clauses over the variables bit id + 1. Only reads the gate
+	// list and writes `cnf`, so it can run in a worker thread.
+	static void encode_gates(const std::vector<ImportGate> &gates, int begin, int end, std::vector<std::vector<int>> &cnf)
+	{
+		auto emit_and = [&](int y, int a, int b) {
+			cnf.push_back({-y, a});
+			cnf.push_back({-y, b});
+			cnf.push_back({y, -a, -b});
+		};
+		auto emit_xor = [&](int y, int a, int b) {
+			cnf.push_back({-y, a, b});
+			cnf.push_back({-y, -a, -b});
+			cnf.push_back({y, -a, b});
+			cnf.push_back({y, a, -b});
+		};
+
+		for (int i = begin; i < end; i++)
+		{
+			const ImportGate &g = gates[i];
+			int y = g.y + 1, a = g.a + 1, b = g.b + 1, s = g.s + 1;
+			switch (g.type)
+			{
+			case SatSim::G_BUF:
+				cnf.push_back({-y, a});
+				cnf.push_back({y, -a});
+				break;
+			case SatSim::G_NOT:
+				cnf.push_back({-y, -a});
+				cnf.push_back({y, a});
+				break;
+			case SatSim::G_AND:    emit_and(y, a, b);    break;
+			case SatSim::G_NAND:   emit_and(-y, a, b);   break;
+			case SatSim::G_OR:     emit_and(-y, -a, -b); break;
+			case SatSim::G_NOR:    emit_and(y, -a, -b);  break;
+			case SatSim::G_ANDNOT: emit_and(y, a, -b);   break;
+			case SatSim::G_ORNOT:  emit_and(-y, -a, b);  break;
+			case SatSim::G_XOR:    emit_xor(y, a, b);    break;
+			case SatSim::G_XNOR:   emit_xor(-y, a, b);   break;
+			case SatSim::G_MUX:
+				cnf.push_back({-s, -b, y});
+				cnf.push_back({-s, b, -y});
+				cnf.push_back({s, -a, y});
+				cnf.push_back({s, a, -y});
+				break;
+			default:
+				log_abort();
+			}
+		}
+	}
+
+	// Import the cells accepted by parallel_gate(). On the first call the main thread turns
+	// them into a gate list over integer bit ids and the workers encode shares of it without
+	// touching the netlist, SatGen or any other Yosys state. The CNF does not depend on the
+	// time step, every call adds it in one pass over the literals of the time step.
+	void import_parallel(const std::vector<RTLIL::Cell*> &cells, int timestep, int &import_cell_counter)
+	{
+		if (par_num_cells < 0)
+		{
+			std::vector<ImportGate> gates;
+			for (auto cell : cells) {
+				int type;
+				bool ok = parallel_gate(cell, type);
+				log_assert(ok);
+				RTLIL::SigSpec y = sigmap(cell->getPort(ID::Y)), a = sigmap(cell->getPort(ID::A)), b, s;
+				if (cell->hasPort(ID::B))
+					b = sigmap(cell->getPort(ID::B));
+				if (cell->hasPort(ID::S))
+					s = sigmap(cell->getPort(ID::S));
+				for (int i = 0; i < GetSize(y); i++) {
+					ImportGate g;
+					g.type = type;
+					g.y = par_bits(y[i]);
+					g.a = par_bits(a[i]);
+					g.b = GetSize(b) ? par_bits(b[i]) : -1;
+					g.s = GetSize(s) ? par_bits(s[0]) : -1;
+					gates.push_back(g);
+				}
+			}
+
+			int num_workers = max(1, min(threads, GetSize(gates)));
+			std::vector<std::vector<std::vector<int>>> worker_cnf(num_workers);
+			auto range = [&](int wi) { return int(int64_t(wi) * GetSize(gates) / num_workers); };
+#ifdef YOSYS_ENABLE_THREADS
+			std::vector<std::thread> workers;
+			for (int wi = 0; wi < num_workers; wi++)
+				workers.emplace_back(encode_gates, std::cref(gates), range(wi), range(wi + 1), std::ref(worker_cnf[wi]));
+			for (auto &t : workers)
+				t.join();
+#else
+			for (int wi = 0; wi < num_workers; wi++)
+				encode_gates(gates, range(wi), range(wi + 1), worker_cnf[wi]);
+#endif
+			for (auto &cnf : worker_cnf)
+				for (auto &clause : cnf)
+					par_cnf.push_back(std::move(clause));
+			par_num_cells = GetSize(cells);
+			log("Encoded %d cells with %d threads: %d gates, %d clauses per time step.\n",
+					GetSize(cells), num_workers, GetSize(gates), GetSize(par_cnf));
+		}
+		log_assert(par_num_cells == GetSize(cells));
+
+		// one pass over the CNF with the literal and the inverted literal of each bit, constant
+		// bits are folded. assume() adds an OR of literals to the solver as a plain clause.
+		RTLIL::SigSpec sig;
+		for (auto bit : par_bits)
+			sig.append(bit);
+		std::vector<int> lits = satgen.importSigSpec(sig, timestep), not_lits(GetSize(lits));
+		for (int i = 0; i < GetSize(lits); i++)
+			not_lits[i] = ez->NOT(lits[i]);
+
+		std::vector<int> clause;
+		for (auto &par_clause : par_cnf)
+		{
+			clause.clear();
+			bool satisfied = false;
+			for (int lit : par_clause) {
+				int l = lit > 0 ? lits[lit - 1] : not_lits[-lit - 1];
+				if (l == ezSAT::CONST_TRUE)
+					satisfied = true;
+				else if (l != ezSAT::CONST_FALSE)
+					clause.push_back(l);
+			}
+			if (!satisfied)
+				ez->assume(ez->expression(ezSAT::OpOr, clause));
+		}
+
+		for (auto cell : cells)
+			show_driver_cells.insert(cell);
+		import_cell_counter += GetSize(cells);
+	}
+
+	struct SetEntry {
+		std::string description;
+		RTLIL::SigSpec lhs, rhs;
+	};
+
+	// later set constraints on the same bits override earlier ones, like big_lhs in setup()
+	static void add_set_entry(std::vector<SetEntry> &entries, const std::string &description, const RTLIL::SigSpec &lhs, const RTLIL::SigSpec &rhs)
+	{
+		for (auto &e : entries)
+			e.lhs.remove2(lhs, &e.rhs);
+		entries.push_back({description, lhs, rhs});
+	}
+
+	// Retractable constraints are guarded by a selector literal and only enforced while the
+	// selector is active, solve() passes all active selectors as assumptions. This way one
+	// encoded circuit can be queried with changing constraints without re-importing it.
+	int add_retractable(int expr)
+	{
+		int sel = ez->literal();
+		ez->assume(ez->OR(ez->NOT(sel), expr));
+		active_selectors.push_back(sel);
+		return sel;
+	}
+
+	// retract a constraint for good, the solver can drop its clauses
+	void retract(int sel)
+	{
+		auto it = std::find(active_selectors.begin(), active_selectors.end(), sel);
+		log_assert(it != active_selectors.end());
+		active_selectors.erase(it);
+		ez->assume(ez->NOT(sel));
+	}
+
+	// parse and check a -set style lhs/rhs pair
+	void parse_set_expr(const std::string &lhs_expr, const std::string &rhs_expr, RTLIL::SigSpec &lhs, RTLIL::SigSpec &rhs)
+	{
+		if (!RTLIL::SigSpec::parse_sel(lhs, design, module, lhs_expr))
+			log_cmd_error("Failed to parse lhs set expression `%s'.\n", lhs_expr.c_str());
+		if (!RTLIL::SigSpec::parse_rhs(lhs, rhs, module, rhs_expr))
+			log_cmd_error("Failed to parse rhs set expression `%s'.\n", rhs_expr.c_str());
+		if (lhs.size() != rhs.size())
+			log_cmd_error("Set expression with different lhs and rhs sizes: %s (%s, %d bits) vs. %s (%s, %d bits)\n",
+				lhs_expr.c_str(), log_signal(lhs), lhs.size(), rhs_expr.c_str(), log_signal(rhs), rhs.size());
+		check_undef_enabled(lhs), check_undef_enabled(rhs);
+	}
+
+	// retractable version of a -set (timestep -1) or -set-at constraint
+	int add_retractable_set(const RTLIL::SigSpec &lhs, const RTLIL::SigSpec &rhs, int timestep = -1)
+	{
+		show_signal_pool.add(sigmap(lhs));
+		show_signal_pool.add(sigmap(rhs));
+		return add_retractable(satgen.signals_eq(lhs, rhs, timestep));
+	}
+
+	int add_retractable_set(const std::string &lhs_expr, const std::string &rhs_expr, int timestep = -1)
+	{
+		RTLIL::SigSpec lhs, rhs;
+		parse_set_expr(lhs_expr, rhs_expr, lhs, rhs);
+		return add_retractable_set(lhs, rhs, timestep);
+	}
+
+	// With -unsat-core every user constraint is added as retractable constraint, so that
+	// print_unsat_core() can search for a small set of selectors that is unsatisfiable.
+	void assume_constraint(int expr, const std::string &description)
+	{
+		if (!track_core) {
+			ez->assume(expr);
+			return;
+		}
+		core_selectors.push_back(add_retractable(expr));
+		core_descriptions.push_back(description);
+	}
+
+	void assume_sets(const std::vector<SetEntry> &entries, const RTLIL::SigSpec &big_lhs, const RTLIL::SigSpec &big_rhs, int timestep)
+	{
+		if (!track_core) {
+			ez->assume(satgen.signals_eq(big_lhs, big_rhs, timestep));
+			return;
+		}
+		for (auto &e : entries)
+			if (e.lhs.size())
+				assume_constraint(satgen.signals_eq(e.lhs, e.rhs, timestep), e.description);
+	}
+
 	void setup(int timestep = -1, bool initstate = false)
 	{
 		if (timestep > 0)
@@ -106,6 +994,8 @@ struct SatHelper
 			max_timestep = timestep;
 
 		RTLIL::SigSpec big_lhs, big_rhs;
+		std::vector<SetEntry> set_entries;
+		std::string at_step = timestep > 0 ? stringf(" at step %d", timestep) : std::string();
 
 		for (auto &s : sets)
 		{
@@ -126,6 +1016,7 @@ struct SatHelper
 			big_lhs.remove2(lhs, &big_rhs);
 			big_lhs.append(lhs);
 			big_rhs.append(rhs);
+			add_set_entry(set_entries, stringf("-set %s %s%s", s.first.c_str(), s.second.c_str(), at_step.c_str()), lhs, rhs);
 		}
 
 		for (auto &s : sets_at[timestep])
@@ -147,6 +1038,7 @@ struct SatHelper
 			big_lhs.remove2(lhs, &big_rhs);
 			big_lhs.append(lhs);
 			big_rhs.append(rhs);
+			add_set_entry(set_entries, stringf("-set-at %d %s %s", timestep, s.first.c_str(), s.second.c_str()), lhs, rhs);
 		}
 
 		for (auto &s : unsets_at[timestep])
@@ -159,11 +1051,13 @@ struct SatHelper
 
 			log("Import unset-constraint for this timestep: %s\n", log_signal(lhs));
 			big_lhs.remove2(lhs, &big_rhs);
+			for (auto &e : set_entries)
+				e.lhs.remove2(lhs, &e.rhs);
 		}
 
 		//log("Final constraint equation: %s = %s\n", log_signal(big_lhs), log_signal(big_rhs));
 		check_undef_enabled(big_lhs), check_undef_enabled(big_rhs);
-		ez->assume(satgen.signals_eq(big_lhs, big_rhs, timestep));
+		assume_sets(set_entries, big_lhs, big_rhs, timestep);
 
 		// 0 = sets_def
 		// 1 = sets_any_undef
@@ -222,28 +1116,52 @@ struct SatHelper
 		for (auto &sig : sets_def_undef[t]) {
 			//log("Import %s constraint for this timestep: %s\n", t == 0 ? "def" : t == 1 ? "any_undef" : "all_undef", log_signal(sig));
 			std::vector<int> undef_sig = satgen.importUndefSigSpec(sig, timestep);
+			std::string description = stringf("%s %s%s", t == 0 ? "-set-def" : t == 1 ? "-set-any-undef" : "-set-all-undef",
+					log_signal(sig), at_step.c_str());
 			if (t == 0)
-				ez->assume(ez->NOT(ez->expression(ezSAT::OpOr, undef_sig)));
+				assume_constraint(ez->NOT(ez->expression(ezSAT::OpOr, undef_sig)), description);
 			if (t == 1)
-				ez->assume(ez->expression(ezSAT::OpOr, undef_sig));
+				assume_constraint(ez->expression(ezSAT::OpOr, undef_sig), description);
 			if (t == 2)
-				ez->assume(ez->expression(ezSAT::OpAnd, undef_sig));
+				assume_constraint(ez->expression(ezSAT::OpAnd, undef_sig), description);
 		}
 
 		int import_cell_counter = 0;
+		std::vector<RTLIL::Cell*> parallel_cells;
 		for (auto cell : module->cells())
 			if (design->selected(module, cell)) {
+				if (cell->type == ID($initstate) && initstate_lits.count(timestep)) {
+					std::vector<int> y = satgen.importDefSigSpec(cell->getPort(ID::Y), timestep);
+					log_assert(GetSize(y) == 1);
+					ez->assume(ez->IFF(y[0], initstate_lits.at(timestep)));
+					if (enable_undef)
+						ez->assume(ez->NOT(satgen.importUndefSigSpec(cell->getPort(ID::Y), timestep).at(0)));
+					show_driver_cells.insert(cell);
+					import_cell_counter++;
+					continue;
+				}
+				if (hier && design->module(cell->type) != nullptr && !design->module(cell->type)->get_blackbox_attribute()) {
+					instantiate(ez.get(), satgen, cell, timestep);
+					show_driver_cells.insert(cell);
+					import_cell_counter++;
+					continue;
+				}
+				int gate_type;
+				if (threads > 1 && !enable_undef && parallel_gate(cell, gate_type)) {
+					parallel_cells.push_back(cell);
+					continue;
+				}
 				// log("Import cell: %s\n", RTLIL::id2cstr(cell->name));
 				if (satgen.importCell(cell, timestep)) {
-					for (auto &p : cell->connections())
-						if (ct.cell_output(cell->type, p.first))
-							show_drivers.insert(sigmap(p.second), cell);
+					show_driver_cells.insert(cell);
 					import_cell_counter++;
 				} else if (ignore_unknown_cells)
 					log_warning("Failed to import cell %s (type %s) to SAT database.\n", RTLIL::id2cstr(cell->name), RTLIL::id2cstr(cell->type));
 				else
 					log_error("Failed to import cell %s (type %s) to SAT database.\n", RTLIL::id2cstr(cell->name), RTLIL::id2cstr(cell->type));
 		}
+		if (!parallel_cells.empty())
+			import_parallel(parallel_cells, timestep, import_cell_counter);
 		//log("Imported %d cells to SAT database.\n", import_cell_counter);
 
 		if (set_assumes) {
@@ -251,12 +1169,13 @@ struct SatHelper
 			satgen.getAssumes(assumes_a, assumes_en, timestep);
 			for (int i = 0; i < GetSize(assumes_a); i++)
 				log("Import constraint from assume cell: %s when %s.\n", log_signal(assumes_a[i]), log_signal(assumes_en[i]));
-			ez->assume(satgen.importAssumes(timestep));
+			assume_constraint(satgen.importAssumes(timestep), "$assume cells" + at_step);
 		}
 
 		if (initstate)
 		{
 			RTLIL::SigSpec big_lhs, big_rhs, forced_def;
+			std::vector<SetEntry> init_entries;
 
 			// Check for $anyinit cells that are forced to be defined
 			if (set_init_undef && satgen.def_formal)
@@ -293,6 +1212,7 @@ struct SatHelper
 					big_lhs.remove2(lhs, &big_rhs);
 					big_lhs.append(lhs);
 					big_rhs.append(rhs);
+					add_set_entry(init_entries, stringf("init attribute on %s", log_id(wire)), lhs, rhs);
 				}
 			}
 
@@ -315,6 +1235,7 @@ struct SatHelper
 				big_lhs.remove2(lhs, &big_rhs);
 				big_lhs.append(lhs);
 				big_rhs.append(rhs);
+				add_set_entry(init_entries, stringf("-set-init %s %s", s.first.c_str(), s.second.c_str()), lhs, rhs);
 			}
 
 			if (!satgen.initial_state.check_all(big_lhs)) {
@@ -325,7 +1246,7 @@ struct SatHelper
 			if (set_init_def) {
 				RTLIL::SigSpec rem = satgen.initial_state.export_all();
 				std::vector<int> undef_rem = satgen.importUndefSigSpec(rem, 1);
-				ez->assume(ez->NOT(ez->expression(ezSAT::OpOr, undef_rem)));
+				assume_constraint(ez->NOT(ez->expression(ezSAT::OpOr, undef_rem)), "-set-init-def");
 			}
 
 			if (set_init_undef) {
@@ -334,6 +1255,7 @@ struct SatHelper
 				rem.remove(forced_def);
 				big_lhs.append(rem);
 				big_rhs.append(RTLIL::SigSpec(RTLIL::State::Sx, rem.size()));
+				add_set_entry(init_entries, "-set-init-undef", rem, RTLIL::SigSpec(RTLIL::State::Sx, rem.size()));
 			}
 
 			if (set_init_zero) {
@@ -341,6 +1263,7 @@ struct SatHelper
 				rem.remove(big_lhs);
 				big_lhs.append(rem);
 				big_rhs.append(RTLIL::SigSpec(RTLIL::State::S0, rem.size()));
+				add_set_entry(init_entries, "-set-init-zero", rem, RTLIL::SigSpec(RTLIL::State::S0, rem.size()));
 			}
 
 			if (big_lhs.size() == 0) {
@@ -350,89 +1273,208 @@ struct SatHelper
 
 			log("Final init constraint equation: %s = %s\n", log_signal(big_lhs), log_signal(big_rhs));
 			check_undef_enabled(big_lhs), check_undef_enabled(big_rhs);
-			ez->assume(satgen.signals_eq(big_lhs, big_rhs, timestep));
+			assume_sets(init_entries, big_lhs, big_rhs, timestep);
 		}
 	}
 
-	int setup_proof(int timestep = -1)
+	// Collect the initial value of each state bit from init attributes, -set-init and
+	// -set-init-zero. Bits without initial value are returned as Sx.
+	RTLIL::Const get_init_values(const RTLIL::SigSpec &state_signals)
 	{
-		log_assert(prove.size() || prove_x.size() || prove_asserts);
-
-		RTLIL::SigSpec big_lhs, big_rhs;
-		std::vector<int> prove_bits;
+		dict<RTLIL::SigBit, RTLIL::State> init_bits;
 
-		if (prove.size() > 0)
+		for (auto wire : module->wires())
 		{
-			for (auto &s : prove)
-			{
-				RTLIL::SigSpec lhs, rhs;
+			if (wire->attributes.count(ID::init) == 0)
+				continue;
 
-				if (!RTLIL::SigSpec::parse_sel(lhs, design, module, s.first))
-					log_cmd_error("Failed to parse lhs proof expression `%s'.\n", s.first.c_str());
-				if (!RTLIL::SigSpec::parse_rhs(lhs, rhs, module, s.second))
-					log_cmd_error("Failed to parse rhs proof expression `%s'.\n", s.second.c_str());
-				show_signal_pool.add(sigmap(lhs));
-				show_signal_pool.add(sigmap(rhs));
+			RTLIL::SigSpec lhs = sigmap(wire);
+			RTLIL::Const rhs = wire->attributes.at(ID::init);
+			for (int i = 0; i < lhs.size() && i < GetSize(rhs); i++)
+				if (rhs[i] == State::S0 || rhs[i] == State::S1)
+					init_bits[lhs[i]] = rhs[i];
+		}
 
-				if (lhs.size() != rhs.size())
-					log_cmd_error("Proof expression with different lhs and rhs sizes: %s (%s, %d bits) vs. %s (%s, %d bits)\n",
-						s.first.c_str(), log_signal(lhs), lhs.size(), s.second.c_str(), log_signal(rhs), rhs.size());
+		for (auto &s : sets_init)
+		{
+			RTLIL::SigSpec lhs, rhs;
 
-				log("Import proof-constraint: %s = %s\n", log_signal(lhs), log_signal(rhs));
-				big_lhs.remove2(lhs, &big_rhs);
-				big_lhs.append(lhs);
-				big_rhs.append(rhs);
-			}
+			if (!RTLIL::SigSpec::parse_sel(lhs, design, module, s.first))
+				log_cmd_error("Failed to parse lhs set expression `%s'.\n", s.first.c_str());
+			if (!RTLIL::SigSpec::parse_rhs(lhs, rhs, module, s.second))
+				log_cmd_error("Failed to parse rhs set expression `%s'.\n", s.second.c_str());
+			if (lhs.size() != rhs.size())
+				log_cmd_error("Set expression with different lhs and rhs sizes: %s (%s, %d bits) vs. %s (%s, %d bits)\n",
+					s.first.c_str(), log_signal(lhs), lhs.size(), s.second.c_str(), log_signal(rhs), rhs.size());
+			if (!rhs.is_fully_def())
+				log_cmd_error("Init set-constraint `%s' must have a fully defined constant value.\n", s.first.c_str());
 
-			log("Final proof equation: %s = %s\n", log_signal(big_lhs), log_signal(big_rhs));
-			check_undef_enabled(big_lhs), check_undef_enabled(big_rhs);
-			prove_bits.push_back(satgen.signals_eq(big_lhs, big_rhs, timestep));
+			lhs = sigmap(lhs);
+			for (int i = 0; i < lhs.size(); i++)
+				init_bits[lhs[i]] = rhs[i].data;
 		}
 
-		if (prove_x.size() > 0)
+		RTLIL::Const values(RTLIL::State::Sx, state_signals.size());
+		for (int i = 0; i < state_signals.size(); i++) {
+			auto it = init_bits.find(state_signals[i]);
+			if (it != init_bits.end())
+				values.bits()[i] = it->second;
+			else if (set_init_zero)
+				values.bits()[i] = RTLIL::State::S0;
+		}
+		return values;
+	}
+
+	int setup_proof(int timestep = -1)
+	{
+		log_assert(prove.size() || prove_x.size() || prove_asserts);
+
+		std::vector<int> &prove_bits = proof_scratch;
+		setup_properties(timestep, prove_bits);
+		return ez->expression(ezSAT::OpAnd, prove_bits);
+	}
+
+	// The proof literals of a time step: one for each -prove pair, -prove-x pair and assert.
+	// A pair overrides the bits of earlier pairs of the same kind, pairs that are overridden
+	// completely are dropped. If `names` is given, the description of each literal is appended.
+	void setup_properties(int timestep, std::vector<int> &lits, std::vector<std::string> *names = nullptr)
+	{
+		lits.clear();
+
+		auto parse_pair = [&](const std::pair<std::string, std::string> &s, const char *kind, const char *Kind, RTLIL::SigSpec &lhs, RTLIL::SigSpec &rhs) {
+			if (!RTLIL::SigSpec::parse_sel(lhs, design, module, s.first))
+				log_cmd_error("Failed to parse lhs %s expression `%s'.\n", kind, s.first.c_str());
+			if (!RTLIL::SigSpec::parse_rhs(lhs, rhs, module, s.second))
+				log_cmd_error("Failed to parse rhs %s expression `%s'.\n", kind, s.second.c_str());
+			show_signal_pool.add(sigmap(lhs));
+			show_signal_pool.add(sigmap(rhs));
+
+			if (lhs.size() != rhs.size())
+				log_cmd_error("%s expression with different lhs and rhs sizes: %s (%s, %d bits) vs. %s (%s, %d bits)\n", Kind,
+					s.first.c_str(), log_signal(lhs), lhs.size(), s.second.c_str(), log_signal(rhs), rhs.size());
+		};
+
+		auto log_final = [&](const std::vector<SetEntry> &entries, const char *kind) {
+			RTLIL::SigSpec big_lhs, big_rhs;
+			for (auto &e : entries)
+				big_lhs.append(e.lhs), big_rhs.append(e.rhs);
+			log("Final %s equation: %s = %s\n", kind, log_signal(big_lhs), log_signal(big_rhs));
+		};
+
+		if (prove.size() > 0)
 		{
-			for (auto &s : prove_x)
+			std::vector<SetEntry> entries;
+			for (auto &s : prove)
 			{
 				RTLIL::SigSpec lhs, rhs;
+				parse_pair(s, "proof", "Proof", lhs, rhs);
+				log("Import proof-constraint: %s = %s\n", log_signal(lhs), log_signal(rhs));
+				add_set_entry(entries, stringf("-prove %s %s", s.first.c_str(), s.second.c_str()), lhs, rhs);
+			}
+			log_final(entries, "proof");
 
-				if (!RTLIL::SigSpec::parse_sel(lhs, design, module, s.first))
-					log_cmd_error("Failed to parse lhs proof-x expression `%s'.\n", s.first.c_str());
-				if (!RTLIL::SigSpec::parse_rhs(lhs, rhs, module, s.second))
-					log_cmd_error("Failed to parse rhs proof-x expression `%s'.\n", s.second.c_str());
-				show_signal_pool.add(sigmap(lhs));
-				show_signal_pool.add(sigmap(rhs));
-
-				if (lhs.size() != rhs.size())
-					log_cmd_error("Proof-x expression with different lhs and rhs sizes: %s (%s, %d bits) vs. %s (%s, %d bits)\n",
-						s.first.c_str(), log_signal(lhs), lhs.size(), s.second.c_str(), log_signal(rhs), rhs.size());
+			for (auto &e : entries) {
+				if (GetSize(e.lhs) == 0)
+					continue;
+				check_undef_enabled(e.lhs), check_undef_enabled(e.rhs);
+				if (names)
+					names->push_back(e.description);
+				lits.push_back(satgen.signals_eq(e.lhs, e.rhs, timestep));
+			}
+		}
 
+		if (prove_x.size() > 0)
+		{
+			std::vector<SetEntry> entries;
+			for (auto &s : prove_x)
+			{
+				RTLIL::SigSpec lhs, rhs;
+				parse_pair(s, "proof-x", "Proof-x", lhs, rhs);
 				log("Import proof-x-constraint: %s = %s\n", log_signal(lhs), log_signal(rhs));
-				big_lhs.remove2(lhs, &big_rhs);
-				big_lhs.append(lhs);
-				big_rhs.append(rhs);
+				add_set_entry(entries, stringf("-prove-x %s %s", s.first.c_str(), s.second.c_str()), lhs, rhs);
 			}
+			log_final(entries, "proof-x");
 
-			log("Final proof-x equation: %s = %s\n", log_signal(big_lhs), log_signal(big_rhs));
+			for (auto &e : entries)
+			{
+				if (GetSize(e.lhs) == 0)
+					continue;
 
-			std::vector<int> value_lhs = satgen.importDefSigSpec(big_lhs, timestep);
-			std::vector<int> value_rhs = satgen.importDefSigSpec(big_rhs, timestep);
+				std::vector<int> value_lhs = satgen.importDefSigSpec(e.lhs, timestep);
+				std::vector<int> value_rhs = satgen.importDefSigSpec(e.rhs, timestep);
 
-			std::vector<int> undef_lhs = satgen.importUndefSigSpec(big_lhs, timestep);
-			std::vector<int> undef_rhs = satgen.importUndefSigSpec(big_rhs, timestep);
+				std::vector<int> undef_lhs = satgen.importUndefSigSpec(e.lhs, timestep);
+				std::vector<int> undef_rhs = satgen.importUndefSigSpec(e.rhs, timestep);
 
-			for (size_t i = 0; i < value_lhs.size(); i++)
-				prove_bits.push_back(ez->OR(undef_lhs.at(i), ez->AND(ez->NOT(undef_rhs.at(i)), ez->NOT(ez->XOR(value_lhs.at(i), value_rhs.at(i))))));
+				std::vector<int> bits;
+				for (size_t i = 0; i < value_lhs.size(); i++)
+					bits.push_back(ez->OR(undef_lhs.at(i), ez->AND(ez->NOT(undef_rhs.at(i)), ez->NOT(ez->XOR(value_lhs.at(i), value_rhs.at(i))))));
+				if (names)
+					names->push_back(e.description);
+				lits.push_back(ez->expression(ezSAT::OpAnd, bits));
+			}
 		}
 
-		if (prove_asserts) {
+		if (prove_asserts)
+		{
+			// same condition as SatGen::importAsserts(), but for each assert on its own
 			RTLIL::SigSpec asserts_a, asserts_en;
 			satgen.getAsserts(asserts_a, asserts_en, timestep);
-			for (int i = 0; i < GetSize(asserts_a); i++)
+			std::vector<int> check_bits = satgen.importDefSigSpec(asserts_a, timestep);
+			std::vector<int> enable_bits = satgen.importDefSigSpec(asserts_en, timestep);
+			if (satgen.model_undef) {
+				check_bits = ez->vec_and(ez->vec_not(satgen.importUndefSigSpec(asserts_a, timestep)), check_bits);
+				enable_bits = ez->vec_and(ez->vec_not(satgen.importUndefSigSpec(asserts_en, timestep)), enable_bits);
+			}
+			for (int i = 0; i < GetSize(asserts_a); i++) {
 				log("Import proof for assert: %s when %s.\n", log_signal(asserts_a[i]), log_signal(asserts_en[i]));
-			prove_bits.push_back(satgen.importAsserts(timestep));
+				if (names)
+					names->push_back(stringf("assert %s when %s", log_signal(asserts_a[i]), log_signal(asserts_en[i])));
+				lits.push_back(ez->OR(check_bits[i], ez->NOT(enable_bits[i])));
+			}
 		}
+	}
 
-		return ez->expression(ezSAT::OpAnd, prove_bits);
+	// -prove-each: check each property on its own, in the same solver. A proven property is
+	// assumed for the remaining checks, a failing one is reported with its model and dropped.
+	// Properties that timed out are retried as long as the previous round proved something new.
+	// `dump_model` is called with the index of each failing property while its model is current.
+	// Returns the status of each property: 0 = PASS, 1 = FAIL, 2 = UNKNOWN.
+	std::vector<int> prove_each(const std::vector<std::string> &names, const std::vector<int> &properties,
+			const std::function<void(int)> &dump_model)
+	{
+		std::vector<int> status(GetSize(properties), 2);
+		bool progress = true;
+
+		while (progress)
+		{
+			progress = false;
+			for (int i = 0; i < GetSize(properties); i++)
+			{
+				if (status[i] != 2)
+					continue;
+
+				log("\nChecking %s..\n", names[i].c_str());
+				log_flush();
+
+				if (solve(ez->NOT(properties[i]))) {
+					log("Property fails:\n");
+					print_model();
+					dump_model(i);
+					status[i] = 1;
+				} else if (gotTimeout) {
+					log("Interrupted SAT solver: TIMEOUT!\n");
+					gotTimeout = false;
+				} else {
+					log("Property holds.\n");
+					ez->assume(properties[i]);
+					status[i] = 0;
+					progress = true;
+				}
+			}
+		}
+
+		return status;
 	}
 
 	void force_unique_state(int timestep_from, int timestep_to)
@@ -442,34 +1484,155 @@ struct SatHelper
 			ez->assume(ez->NOT(satgen.signals_eq(state_signals, state_signals, i, timestep_to)));
 	}
 
+	const std::vector<int> &import_state(int timestep)
+	{
+		auto it = state_literals.find(timestep);
+		if (it != state_literals.end())
+			return it->second;
+
+		RTLIL::SigSpec state_signals = satgen.initial_state.export_all();
+		std::vector<int> &lits = state_literals[timestep];
+		lits = satgen.importSigSpec(state_signals, timestep);
+		if (enable_undef) {
+			std::vector<int> undef_lits = satgen.importUndefSigSpec(state_signals, timestep);
+			lits.insert(lits.end(), undef_lits.begin(), undef_lits.end());
+		}
+		return lits;
+	}
+
+	// Alternative to force_unique_state(): solve without uniqueness constraints and only add
+	// the disequality for a pair of states once a model actually visits the same state twice.
+	// Memory stays linear in the number of time steps unless the design really loops.
+	bool solve_lazy_unique(int assumption, int timestep_from, int timestep_to)
+	{
+		RTLIL::SigSpec state_signals = satgen.initial_state.export_all();
+		int state_width = state_signals.size();
+
+		while (1)
+		{
+			extraExpressions.clear();
+			for (int t = timestep_from; t <= timestep_to; t++) {
+				const std::vector<int> &lits = import_state(t);
+				extraExpressions.insert(extraExpressions.end(), lits.begin(), lits.end());
+			}
+
+			bool success = solve(assumption);
+			extraExpressions.clear();
+			if (!success)
+				return false;
+
+			// hash the states of the model and rule out every repeat at once, each state
+			// against the first time step that visited it. undef state bits compare equal
+			// regardless of their value bit (see signals_eq).
+			dict<std::string, int> first_visit;
+			int stride = enable_undef ? 2*state_width : state_width;
+			int new_constraints = 0;
+
+			for (int t = timestep_from; t <= timestep_to; t++) {
+				int base = (t - timestep_from) * stride;
+				std::string key(state_width, '0');
+				for (int i = 0; i < state_width; i++)
+					if (enable_undef && extraValues.at(base + state_width + i))
+						key[i] = 'x';
+					else if (extraValues.at(base + i))
+						key[i] = '1';
+				auto it = first_visit.find(key);
+				if (it == first_visit.end()) {
+					first_visit[key] = t;
+					continue;
+				}
+				ez->assume(ez->NOT(satgen.signals_eq(state_signals, state_signals, it->second, t)));
+				new_constraints++;
+			}
+
+			if (new_constraints == 0)
+				return true;
+
+			lazy_unique_constraints += new_constraints;
+			log("Model contains %d repeated state(s), adding uniqueness constraints (%d so far).\n",
+					new_constraints, lazy_unique_constraints);
+		}
+	}
+
 	bool solve(const std::vector<int> &assumptions)
 	{
 		log_assert(gotTimeout == false);
 		ez->setSolverTimeout(timeout);
-		bool success = ez->solve(modelExpressions, modelValues, assumptions);
+		bool success;
+		std::vector<bool> values;
+		std::vector<int> all_assumptions = assumptions;
+		if (failure_act != 0)
+			all_assumptions.push_back(failure_act);
+		all_assumptions.insert(all_assumptions.end(), active_selectors.begin(), active_selectors.end());
+		model_pending = false;
+		if (lazy_model) {
+			success = ez->solve(extraExpressions, values, all_assumptions);
+			if (success) {
+				extraValues = values;
+				pending_assumptions = all_assumptions;
+				for (int i = 0; i < GetSize(extraExpressions); i++)
+					pending_assumptions.push_back(values[i] ? extraExpressions[i] : ez->NOT(extraExpressions[i]));
+				model_pending = true;
+			}
+		} else if (extraExpressions.empty()) {
+			success = ez->solve(modelExpressions, values, all_assumptions);
+		} else {
+			std::vector<int> expressions = modelExpressions;
+			expressions.insert(expressions.end(), extraExpressions.begin(), extraExpressions.end());
+			success = ez->solve(expressions, values, all_assumptions);
+			if (success)
+				extraValues.assign(values.begin() + modelExpressions.size(), values.end());
+		}
+		if (success && !lazy_model)
+			modelValues.load(values, GetSize(modelExpressions), enable_undef);
 		if (ez->getSolverTimoutStatus())
 			gotTimeout = true;
 		return success;
 	}
 
-	bool solve(int a = 0, int b = 0, int c = 0, int d = 0, int e = 0, int f = 0)
+	// lazy_model: extend the model tables and read the model of the last successful solve(),
+	// by solving again with its assumptions and the values of its extra expressions
+	void ensure_model()
+	{
+		if (!model_pending)
+			return;
+		model_pending = false;
+		generate_model();
+
+		std::vector<bool> values;
+		ez->setSolverTimeout(0);
+		bool success = ez->solve(modelExpressions, values, pending_assumptions);
+		log_assert(success);
+		modelValues.load(values, GetSize(modelExpressions), enable_undef);
+	}
+
+	// solve for an arbitrary set of expressions, leaving the model untouched
+	bool solve_expressions(const std::vector<int> &assumptions, const std::vector<int> &expressions, std::vector<bool> &values)
 	{
 		log_assert(gotTimeout == false);
 		ez->setSolverTimeout(timeout);
-		bool success = ez->solve(modelExpressions, modelValues, a, b, c, d, e, f);
+		bool success = ez->solve(expressions, values, assumptions);
 		if (ez->getSolverTimoutStatus())
 			gotTimeout = true;
 		return success;
 	}
 
+	bool solve(int a = 0, int b = 0, int c = 0, int d = 0, int e = 0, int f = 0)
+	{
+		std::vector<int> assumptions;
+		for (int lit : {a, b, c, d, e, f})
+			if (lit != 0)
+				assumptions.push_back(lit);
+		return solve(assumptions);
+	}
+
 	struct ModelBlockInfo {
-		int timestep, offset, width;
-		std::string description;
+		int timestep, name, offset, width;
 		bool operator < (const ModelBlockInfo &other) const {
 			if (timestep != other.timestep)
 				return timestep < other.timestep;
-			if (description != other.description)
-				return description < other.description;
+			if (name != other.name)
+				return name < other.name;
 			if (offset != other.offset)
 				return offset < other.offset;
 			if (width != other.width)
@@ -479,482 +1642,2034 @@ struct SatHelper
 	};
 
 	std::vector<int> modelExpressions;
-	std::vector<bool> modelValues;
-	std::set<ModelBlockInfo> modelInfo;
-
-void maximize_undefs()
-{
-	log_assert(enable_undef);
-	std::vector<bool> backupValues;
+	SatModel modelValues;
+
+	// model blocks, sorted on demand by model_blocks(). the names are interned in
+	// alphabetical order, so comparing name ids is the same as comparing the names.
+	std::vector<ModelBlockInfo> modelInfo;
+	std::vector<std::string> modelNames;
+	std::vector<int> modelNameWidths;
+	bool modelInfoSorted = true;
+
+	// incremental model tables, see generate_model()
+	std::vector<int> modelValueExpressions, modelUndefExpressions;
+	std::vector<RTLIL::SigChunk> model_chunks;
+	std::vector<int> model_chunk_names;
+	int model_timestep = -2, model_pool_size = 0;
+
+	// signal and time step of each model bit, time step 0 is the initial state
+	std::vector<RTLIL::SigBit> model_bits;
+	std::vector<int> model_bit_timesteps;
+
+	// imported literals of a model chunk at a time step, keyed by (first bit, width, time
+	// step), so that rebuilding the model tables in reset_model() doesn't import them again
+	struct ModelLits {
+		std::vector<int> value, undef;
+		std::vector<RTLIL::SigBit> bits;
+	};
+	dict<std::tuple<RTLIL::SigBit, int, int>, ModelLits> model_lit_cache;
+
+	// simulator for the maximize_undefs() pre-pass (0 = not compiled, 1 = ok, -1 = unusable)
+	SatSim undef_sim;
+	int undef_sim_state = 0;
+
+	// counter example replay, see prepare_replay(). inputs are (bit id, index in extraValues)
+	SatSimT<SimWord> replay_sim;
+	int replay_state = 0;  // 0 = not compiled, 1 = ok, -1 = unusable
+	int replay_prove_skip = 0, replay_num_inputs = 0;
+	std::vector<int> replay_lits;
+	std::vector<int> replay_steps;
+	std::vector<std::vector<std::pair<int, int>>> replay_inputs;
+	std::vector<std::pair<int, int>> replay_prove, replay_prove_x, replay_asserts;
+
+	// additional literals evaluated by solve() alongside the model (not printed)
+	std::vector<int> extraExpressions;
+	std::vector<bool> extraValues;
+
+	// -tempinduct base case: solve() leaves the model tables alone, most solves are UNSAT and
+	// the model is only read once a step fails. See ensure_model().
+	bool lazy_model = false, model_pending = false;
+	std::vector<int> pending_assumptions;
+
+	// -minimize-cex: the failure of the proof condition is only assumed when solve() passes
+	// failure_act, so the condition itself can be checked under other assumptions
+	bool minimize = false;
+	int failure_act = 0, proof_property = 0;
+
+	// state literals per time step, used by solve_lazy_unique()
+	std::map<int, std::vector<int>> state_literals;
+	int lazy_unique_constraints = 0;
+
+	// signals forced defined at a time step by -set-def, -set-def-inputs, -set-def-at and
+	// -set-init-def, with the same overrides by -set-*-undef-at as in setup()
+	RTLIL::SigSpec forced_def_signals(int timestep)
+	{
+		std::set<RTLIL::SigSpec> def_sigs;
+		auto parse = [&](const std::string &s) {
+			RTLIL::SigSpec sig;
+			if (!RTLIL::SigSpec::parse_sel(sig, design, module, s))
+				log_cmd_error("Failed to parse set-def expression `%s'.\n", s.c_str());
+			return sig;
+		};
+
+		for (auto &s : sets_def)
+			def_sigs.insert(parse(s));
+		if (sets_def_at.count(timestep))
+			for (auto &s : sets_def_at.at(timestep))
+				def_sigs.insert(parse(s));
+		for (auto undef_at : {&sets_any_undef_at, &sets_all_undef_at})
+			if (undef_at->count(timestep))
+				for (auto &s : undef_at->at(timestep))
+					def_sigs.erase(parse(s));
+
+		RTLIL::SigSpec sig;
+		for (auto &it : def_sigs)
+			sig.append(it);
+		if (set_init_def && timestep == 1)
+			sig.append(satgen.initial_state.export_all());
+		return sig;
+	}
 
-// 	// === 第 1 阶段：只优化 X ===
-	while (true)
+	// Pre-pass for maximize_undefs(): three-valued simulation of the current model. Model
+	// inputs are made undef greedily, 64 candidates per simulation run (lane k makes the
+	// first k+1 candidates undef), as long as no set, prove or assert signal changes and
+	// the signals forced defined stay defined. The result is confirmed with one solver
+	// call, everything else is left to the SAT loop.
+	void prefilter_undefs(bool only_x)
 	{
-		std::vector<int> must_undef, maybe_undef;
+		if (undef_sim_state == 0) {
+			std::vector<RTLIL::Cell*> cells(show_driver_cells.begin(), show_driver_cells.end());
+			undef_sim_state = undef_sim.compile(cells, sigmap) ? 1 : -1;
+			if (undef_sim_state < 0)
+				log("Not using simulation for -max_undef: %s.\n", undef_sim.error.c_str());
+		}
+		if (undef_sim_state < 0 || gotTimeout)
+			return;
 
-		for (size_t i = 0; i < modelExpressions.size() / 2; i++){
-			if (modelValues.at(modelExpressions.size() / 2 + i)){
-				int expr = modelExpressions.at(modelExpressions.size() / 2 + i);
-				if (std::find(fuckingX.begin(), fuckingX.end(), expr) != fuckingX.end()) {
-					must_undef.push_back(expr);
+		int width = modelValues.width;
+		log_assert(width == GetSize(model_bits));
+
+		std::vector<int> observed;
+		for (auto bit : show_signal_pool.export_all())
+			if (bit.wire != NULL)
+				observed.push_back(undef_sim.bits(bit));
+		for (auto cell : show_driver_cells)
+			if (cell->type.in(ID($assert), ID($assume)))
+				for (auto port : {ID::A, ID::EN})
+					for (auto bit : sigmap(cell->getPort(port)))
+						if (bit.wire != NULL)
+							observed.push_back(undef_sim.bits(bit));
+
+		std::vector<int> steps;
+		dict<std::pair<int, int>, int> model_index;
+		for (int i = 0; i < width; i++) {
+			if (model_bits[i].wire == NULL)
+				continue;
+			model_index[std::make_pair(model_bit_timesteps[i], undef_sim.bits(model_bits[i]))] = i;
+			if (model_bit_timesteps[i] != 0)
+				steps.push_back(model_bit_timesteps[i]);
+		}
+		std::sort(steps.begin(), steps.end());
+		steps.erase(std::unique(steps.begin(), steps.end()), steps.end());
+
+		// bits forced defined in each step: must stay defined in every lane, and are no
+		// candidates themselves
+		std::vector<std::vector<int>> step_def(GetSize(steps));
+		pool<std::pair<int, int>> forced_def;
+		std::vector<int> cone_roots = observed;
+		for (int si = 0; si < GetSize(steps); si++)
+			for (auto bit : sigmap(forced_def_signals(steps[si])))
+				if (bit.wire != NULL) {
+					int id = undef_sim.bits(bit);
+					step_def[si].push_back(id);
+					cone_roots.push_back(id);
+					forced_def.insert(std::make_pair(steps[si], id));
+				}
+
+		undef_sim.select_cone(cone_roots);
+
+		// model bit feeding each simulation input, flip-flop outputs only in the first step
+		std::vector<std::vector<std::pair<int, int>>> step_inputs(GetSize(steps));
+		std::vector<bool> is_input(width);
+		for (int si = 0; si < GetSize(steps); si++)
+			for (int id : undef_sim.cone_inputs) {
+				if (undef_sim.is_state[id] && si > 0)
+					continue;
+				auto it = model_index.find(std::make_pair(steps[si], id));
+				if (it == model_index.end() && undef_sim.is_state[id])
+					it = model_index.find(std::make_pair(0, id));
+				if (it == model_index.end()) {
+					log("Not using simulation for -max_undef: %s is not part of the model.\n", log_signal(undef_sim.bits[id]));
+					undef_sim_state = -1;
+					return;
 				}
+				step_inputs[si].push_back(std::make_pair(id, it->second));
+				is_input[it->second] = true;
+			}
+
+		// run all time steps, return the lanes in which an observed signal differs from base
+		std::vector<uint64_t> base(2 * GetSize(steps) * GetSize(observed));
+		auto run = [&](const std::vector<uint64_t> &xmask, bool record) -> uint64_t
+		{
+			uint64_t failed = 0;
+			std::vector<uint64_t> state_val, state_def;
+			for (int si = 0; si < GetSize(steps); si++) {
+				for (auto &it : step_inputs[si]) {
+					uint64_t d = modelValues.get_undef(it.second) ? 0 : ~xmask[it.second];
+					undef_sim.val[it.first] = modelValues.get(it.second) ? d : 0;
+					undef_sim.def[it.first] = d;
 				}
-			else{
-				int expr = modelExpressions.at(modelExpressions.size() / 2 + i);
-				// 使用 std::find 替代手动遍历
-				if (std::find(fuckingX.begin(), fuckingX.end(), expr) != fuckingX.end()) {
-					maybe_undef.push_back(expr);
+				if (si > 0)
+					undef_sim.load_state(state_val, state_def);
+				undef_sim.eval();
+				undef_sim.save_state(state_val, state_def);
+				for (int k = 0; k < GetSize(observed); k++) {
+					int id = observed[k], r = 2 * (si * GetSize(observed) + k);
+					if (record)
+						base[r] = undef_sim.val[id], base[r + 1] = undef_sim.def[id];
+					else
+						failed |= (undef_sim.val[id] ^ base[r]) | (undef_sim.def[id] ^ base[r + 1]);
 				}
-				
+				for (int id : step_def[si])
+					failed |= ~undef_sim.def[id];
 			}
-		}
-		// 进行一次解
-		backupValues.swap(modelValues);
-		if (!solve(ez->expression(ezSAT::OpAnd, must_undef), ez->expression(ezSAT::OpOr, maybe_undef)))
-			break;
-		// if(maybe_undef.empty()) {
-		// 	std::cout<<"All X signals successfully set to undef. Done.\n";
-		// 	return;
-		// }
-	}
-	backupValues.swap(modelValues);
-	//=== 第 2 阶段：继续对 L 优化 ===
-		while (1)
+			return failed;
+		};
+
+		std::vector<int> candidates;
+		for (int i = 0; i < width; i++)
+			if (is_input[i] && !modelValues.get_undef(i) && (!only_x || x_lits.count(modelExpressions.at(width + i))) &&
+					!forced_def.count(std::make_pair(model_bit_timesteps[i], undef_sim.bits(model_bits[i]))))
+				candidates.push_back(i);
+		if (candidates.empty())
+			return;
+
+		std::vector<uint64_t> xmask(width, 0);
+		run(xmask, true);
+
+		std::vector<int> accepted;
+		for (int pos = 0; pos < GetSize(candidates);)
 		{
-			std::vector<int> must_undef, maybe_undef;
+			int batch = min(64, GetSize(candidates) - pos);
+			for (int j = 0; j < batch; j++)
+				xmask[candidates[pos + j]] = ~uint64_t(0) << j;
+
+			// undef only ever spreads, so the failing lanes are a suffix of the batch
+			uint64_t failed = run(xmask, false);
+			int good = batch;
+			for (int j = 0; j < batch; j++)
+				if ((failed >> j) & 1) {
+					good = j;
+					break;
+				}
 
-			for (size_t i = 0; i < modelExpressions.size()/2; i++)
-			{	
-				if (modelValues.at(modelExpressions.size()/2 + i))
-					must_undef.push_back(modelExpressions.at(modelExpressions.size()/2 + i));
-				else
-					maybe_undef.push_back(modelExpressions.at(modelExpressions.size()/2 + i));
-			}
-			backupValues.swap(modelValues);
-			if (!solve(ez->expression(ezSAT::OpAnd, must_undef), ez->expression(ezSAT::OpOr, maybe_undef)))
-				break;
+			for (int j = 0; j < batch; j++)
+				xmask[candidates[pos + j]] = j < good ? ~uint64_t(0) : 0;
+			for (int j = 0; j < good; j++)
+				accepted.push_back(candidates[pos + j]);
+			pos += good < batch ? good + 1 : batch;
 		}
 
-	backupValues.swap(modelValues);
-	
-}
-
-// 	void maximize_undefs()
-// 	{
-// 		log_assert(enable_undef);
-// 		std::vector<bool> backupValues;
-// 		std::vector<int> must_undef, maybe_undef;
-// 		while (1)
-// 		{
-// 			for (size_t i = 0; i < modelExpressions.size()/2; i++)
-// 			{	
-// 				if (modelValues.at(modelExpressions.size()/2 + i)){
-// 					int expr = modelExpressions.at(modelExpressions.size()/2 + i);
-// 					if (std::find(fuckingX.begin(), fuckingX.end(), expr) != fuckingX.end()) {
-// 					must_undef.push_back(expr);
-// 				}
-// 				}
-// 				else{
-// 					int expr = modelExpressions.at(modelExpressions.size()/2 + i);
-// 					if (std::find(fuckingX.begin(), fuckingX.end(), expr) != fuckingX.end()) {
-// 					maybe_undef.push_back(expr);
-// 				}
-// }
-// 			}
-// 			backupValues.swap(modelValues);
-// 			if (!solve(ez->expression(ezSAT::OpAnd, must_undef), ez->expression(ezSAT::OpOr, maybe_undef)))
-// 				break;
-// 			// if(maybe_undef.empty()) {
-// 			// std::cout<<"All X signals successfully set to undef. Done.\n";
-// 			// return;
-// 			// 	}	
-// 		}
-// 		backupValues.swap(modelValues);
-// 		// while (1)
-// 		// {
+		if (accepted.empty())
+			return;
 
-// 		// 	for (size_t i = 0; i < modelExpressions.size()/2; i++)	
-// 		// 		if (modelValues.at(modelExpressions.size()/2 + i))
-// 		// 			must_undef.push_back(modelExpressions.at(modelExpressions.size()/2 + i));
-// 		// 		else
-// 		// 			maybe_undef.push_back(modelExpressions.at(modelExpressions.size()/2 + i));
+		std::vector<int> undef_lits;
+		for (int i = 0; i < width; i++)
+			if (modelValues.get_undef(i) && (!only_x || x_lits.count(modelExpressions.at(width + i))))
+				undef_lits.push_back(modelExpressions.at(width + i));
+		for (int i : accepted)
+			undef_lits.push_back(modelExpressions.at(width + i));
+
+		if (solve(ez->expression(ezSAT::OpAnd, undef_lits)))
+			log("Simulation made %d of %d candidate model bits undef.\n", GetSize(accepted), GetSize(candidates));
+		else if (!gotTimeout)
+			log("Simulation result for -max_undef was rejected by the solver, falling back to SAT.\n");
+	}
 
-// 		// 	backupValues.swap(modelValues);
-// 		// 	if (!solve(ez->expression(ezSAT::OpAnd, must_undef), ez->expression(ezSAT::OpOr, maybe_undef)))
-// 		// 		break;
-// 		// }
+	// input values of the counter example found by random_simulation(), by (time step, bit)
+	dict<std::pair<int, RTLIL::SigBit>, bool> random_cex;
 
+	// fix the inputs of the set up problem to the counter example of random_simulation(), so
+	// the solver returns the model of that trace for the usual printing and dumping
+	void assume_random_cex()
+	{
+		for (auto &it : random_cex) {
+			int lit = satgen.importSigSpec(it.first.second, it.first.first).front();
+			ez->assume(it.second ? lit : ez->NOT(lit));
+			if (enable_undef)
+				ez->assume(ez->NOT(satgen.importUndefSigSpec(it.first.second, it.first.first).front()));
+		}
+	}
 
-// 		// backupValues.swap(modelValues);
-// 	}
-	void generate_model()
+	// Random simulation before the CNF is built: simulate `num_vectors` random input patterns,
+	// 64 per run, over all time steps and look for one that meets the -set, -set-at and
+	// $assume constraints but violates the proof condition. Constant -set values and initial
+	// values are applied directly. Only fully defined lanes count, in either direction. The
+	// inputs of a hit go to random_cex, the CNF is still built afterwards to get the model.
+	bool random_simulation(int num_vectors, int seq_len, int prove_skip)
 	{
-		RTLIL::SigSpec modelSig;
-		modelExpressions.clear();
-		modelInfo.clear();
+		if (prove_x.size() || set_init_undef || sets_any_undef.size() || sets_all_undef.size() || sets_any_undef_at.size() || sets_all_undef_at.size()) {
+			log("Skipping random simulation: undef constraints are not supported.\n");
+			return false;
+		}
 
-		// Add "show" signals or alternatively the leaves on the input cone on all set and prove signals
+		std::vector<RTLIL::Cell*> cells;
+		for (auto cell : module->cells())
+			if (design->selected(module, cell))
+				cells.push_back(cell);
 
-		if (shows.size() == 0)
+		SatSim sim;
+		if (!sim.compile(cells, sigmap)) {
+			log("Skipping random simulation: %s.\n", sim.error.c_str());
+			return false;
+		}
+
+		std::vector<int> steps;
+		if (seq_len == 0)
+			steps.push_back(-1);
+		for (int t = 1; t <= seq_len; t++)
+			steps.push_back(t);
+
+		auto parse_pair = [&](const std::pair<std::string, std::string> &s, RTLIL::SigSpec &lhs, RTLIL::SigSpec &rhs) {
+			if (!RTLIL::SigSpec::parse_sel(lhs, design, module, s.first))
+				log_cmd_error("Failed to parse lhs expression `%s'.\n", s.first.c_str());
+			if (!RTLIL::SigSpec::parse_rhs(lhs, rhs, module, s.second))
+				log_cmd_error("Failed to parse rhs expression `%s'.\n", s.second.c_str());
+			if (lhs.size() != rhs.size())
+				log_cmd_error("Expression with different lhs and rhs sizes: %s (%s, %d bits) vs. %s (%s, %d bits)\n",
+					s.first.c_str(), log_signal(lhs), lhs.size(), s.second.c_str(), log_signal(rhs), rhs.size());
+			lhs = sigmap(lhs), rhs = sigmap(rhs);
+		};
+
+		// per time step: constrained (lhs, rhs) bit pairs, a -set-at overrides a -set
+		std::vector<int> roots;
+		std::vector<std::vector<std::pair<int, int>>> step_sets(GetSize(steps));
+		for (int si = 0; si < GetSize(steps); si++)
 		{
-			SigPool queued_signals, handled_signals, final_signals;
-			queued_signals = show_signal_pool;
-			while (queued_signals.size() > 0) {
-				RTLIL::SigSpec sig = queued_signals.export_one();
-				queued_signals.del(sig);
-				handled_signals.add(sig);
-				std::set<RTLIL::Cell*> drivers = show_drivers.find(sig);
-				if (drivers.size() == 0) {
-					final_signals.add(sig);
-				} else {
-					for (auto &d : drivers)
-					for (auto &p : d->connections()) {
-						if (d->type == ID($dff) && p.first == ID::CLK)
-							continue;
-						if (d->type.begins_with("$_DFF_") && p.first == ID::C)
-							continue;
-						queued_signals.add(handled_signals.remove(sigmap(p.second)));
-					}
-				}
+			dict<int, int> constraint;
+			std::vector<std::pair<std::string, std::string>> step_pairs = sets;
+			step_pairs.insert(step_pairs.end(), sets_at[steps[si]].begin(), sets_at[steps[si]].end());
+			for (auto &s : step_pairs) {
+				RTLIL::SigSpec lhs, rhs;
+				parse_pair(s, lhs, rhs);
+				for (int i = 0; i < lhs.size(); i++)
+					constraint[sim.bits(lhs[i])] = sim.bits(rhs[i]);
+			}
+			for (auto &s : unsets_at[steps[si]]) {
+				RTLIL::SigSpec lhs;
+				if (!RTLIL::SigSpec::parse_sel(lhs, design, module, s))
+					log_cmd_error("Failed to parse lhs set expression `%s'.\n", s.c_str());
+				for (auto bit : sigmap(lhs))
+					constraint.erase(sim.bits(bit));
 			}
-			modelSig = final_signals.export_all();
+			for (auto &it : constraint) {
+				step_sets[si].push_back(it);
+				roots.push_back(it.first);
+				roots.push_back(it.second);
+			}
+		}
 
-			// additionally add all set and prove signals directly
-			// (it improves user confidence if we write the constraints back ;-)
-			modelSig.append(show_signal_pool.export_all());
+		std::vector<std::pair<int, int>> proof_bits, asserts, assumes;
+		for (auto &s : prove) {
+			RTLIL::SigSpec lhs, rhs;
+			parse_pair(s, lhs, rhs);
+			for (int i = 0; i < lhs.size(); i++)
+				proof_bits.push_back(std::make_pair(sim.bits(lhs[i]), sim.bits(rhs[i])));
 		}
-		else
-		{
-			for (auto &s : shows) {
-				RTLIL::SigSpec sig;
-				if (!RTLIL::SigSpec::parse_sel(sig, design, module, s))
-					log_cmd_error("Failed to parse show expression `%s'.\n", s.c_str());
-				//log("Import show expression: %s\n", log_signal(sig));
-				modelSig.append(sig);
+		for (auto cell : cells) {
+			if (!(cell->type == ID($assert) && prove_asserts) && !(cell->type == ID($assume) && set_assumes))
+				continue;
+			auto a_en = std::make_pair(sim.bits(sigmap(cell->getPort(ID::A))[0]), sim.bits(sigmap(cell->getPort(ID::EN))[0]));
+			(cell->type == ID($assert) ? asserts : assumes).push_back(a_en);
+		}
+		for (auto &list : {proof_bits, asserts, assumes})
+			for (auto &it : list) {
+				roots.push_back(it.first);
+				roots.push_back(it.second);
 			}
+
+		for (int id : roots)
+			if (sim.bits[id].wire == NULL && sim.bits[id].data != RTLIL::State::S0 && sim.bits[id].data != RTLIL::State::S1) {
+				log("Skipping random simulation: undef constraints are not supported.\n");
+				return false;
+			}
+
+		sim.select_cone(roots);
+
+		// simulation inputs of each step, flip-flop outputs only in the first step
+		std::vector<std::vector<int>> step_inputs(GetSize(steps));
+		for (int si = 0; si < GetSize(steps); si++)
+			for (int id : sim.cone_inputs)
+				if (!sim.is_state[id] || si == 0)
+					step_inputs[si].push_back(id);
+
+		// values fixed by constant -set constraints and by initial values
+		std::vector<dict<int, bool>> fixed(GetSize(steps));
+		for (int si = 0; si < GetSize(steps); si++)
+			for (auto &it : step_sets[si])
+				if (sim.bits[it.second].wire == NULL)
+					fixed[si][it.first] = sim.bits[it.second].data == RTLIL::State::S1;
+		if (seq_len > 0) {
+			RTLIL::SigSpec state_sig;
+			for (int id : step_inputs[0])
+				if (sim.is_state[id])
+					state_sig.append(sim.bits[id]);
+			RTLIL::Const init = get_init_values(state_sig);
+			for (int i = 0; i < GetSize(state_sig); i++)
+				if (init[i] == RTLIL::State::S0 || init[i] == RTLIL::State::S1)
+					if (!fixed[0].count(sim.bits(state_sig[i])))
+						fixed[0][sim.bits(state_sig[i])] = init[i] == RTLIL::State::S1;
 		}
 
-		modelSig.sort_and_unify();
-		// log("Model signals: %s\n", log_signal(modelSig));
+		uint64_t rng = 0x9e3779b97f4a7c15ull;
+		std::vector<std::vector<uint64_t>> input_vals(GetSize(steps));
+		std::vector<uint64_t> state_val, state_def;
+		int runs = (num_vectors + 63) / 64;
 
-		std::vector<int> modelUndefExpressions;
+		for (int run = 0; run < runs; run++)
+		{
+			uint64_t valid = ~uint64_t(0), failed = 0;
+			if (run == runs - 1 && num_vectors % 64 != 0)
+				valid = (uint64_t(1) << (num_vectors % 64)) - 1;
 
-		for (auto &c : modelSig.chunks())
-			if (c.wire != NULL)
+			for (int si = 0; si < GetSize(steps); si++)
 			{
-				string c_name = RTLIL::id2cstr(c.wire->name);
-				ModelBlockInfo info;
-				RTLIL::SigSpec chunksig = c;
-				info.width = chunksig.size();
-				info.description = log_signal(chunksig);
+				input_vals[si].resize(GetSize(step_inputs[si]));
+				for (int k = 0; k < GetSize(step_inputs[si]); k++) {
+					int id = step_inputs[si][k];
+					rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17;
+					uint64_t v = rng;
+					auto it = fixed[si].find(id);
+					if (it != fixed[si].end())
+						v = it->second ? ~uint64_t(0) : 0;
+					input_vals[si][k] = v;
+					sim.val[id] = v, sim.def[id] = ~uint64_t(0);
+				}
+				if (si > 0)
+					sim.load_state(state_val, state_def);
+				sim.eval();
+				sim.save_state(state_val, state_def);
 
-				for (int timestep = -1; timestep <= max_timestep; timestep++)
-				{
-					if ((timestep == -1 && max_timestep > 0) || timestep == 0)
-						continue;
+				for (auto &it : step_sets[si])
+					valid &= sim.def[it.first] & sim.def[it.second] & ~(sim.val[it.first] ^ sim.val[it.second]);
+				for (auto &it : assumes)
+					valid &= sim.def[it.second] & (~sim.val[it.second] | (sim.def[it.first] & sim.val[it.first]));
 
-					info.timestep = timestep;
-					info.offset = modelExpressions.size();
-					modelInfo.insert(info);
+				if (seq_len > 0 && steps[si] <= prove_skip)
+					continue;
+				for (auto &it : proof_bits)
+					failed |= sim.def[it.first] & sim.def[it.second] & (sim.val[it.first] ^ sim.val[it.second]);
+				for (auto &it : asserts)
+					failed |= sim.def[it.first] & sim.def[it.second] & sim.val[it.second] & ~sim.val[it.first];
+			}
 
-					std::vector<int> vec = satgen.importSigSpec(chunksig, timestep);
-					modelExpressions.insert(modelExpressions.end(), vec.begin(), vec.end());
+			uint64_t found = valid & failed;
+			if (found == 0)
+				continue;
 
-					if (enable_undef) {
-						std::vector<int> undef_vec = satgen.importUndefSigSpec(chunksig, timestep);
-					if(c_name=="X"){
-						fuckingX.insert(fuckingX.end(), undef_vec.begin(), undef_vec.end());
-					}
-					if(c_name=="L"){
-						fuckingL.insert(fuckingL.end(), undef_vec.begin(), undef_vec.end());
-					}
-						modelUndefExpressions.insert(modelUndefExpressions.end(), undef_vec.begin(), undef_vec.end());
-					}
-				}
-			}//这个地方比maybe处少3
-			// std::cout << "=== modelExpressions ===" << std::endl;
-			// for (size_t i = 0; i < modelExpressions.size(); ++i)
-			// {
-			// 	int lit = modelExpressions[i];
-			// 	std::cout << "  [" << i << "] = " << lit << std::endl;
-			// }
-		// Add initial state signals as collected by satgen
-		//
-		modelSig = satgen.initial_state.export_all();
-		for (auto &c : modelSig.chunks())
-			if (c.wire != NULL)
-			{
-				ModelBlockInfo info;
-				RTLIL::SigSpec chunksig = c;
+			int lane = 0;
+			while (((found >> lane) & 1) == 0)
+				lane++;
+
+			log("Random simulation found a counter example (pattern %d of %d).\n", 64*run + lane + 1, num_vectors);
+			random_cex.clear();
+			for (int si = 0; si < GetSize(steps); si++)
+				for (int k = 0; k < GetSize(step_inputs[si]); k++)
+					random_cex[std::make_pair(steps[si], sim.bits[step_inputs[si][k]])] = (input_vals[si][k] >> lane) & 1;
+			return true;
+		}
 
-				info.timestep = 0;
-				info.offset = modelExpressions.size();
-				info.width = chunksig.size();
-				info.description = log_signal(chunksig);
-				modelInfo.insert(info);
+		log("Random simulation of %d patterns found no counter example.\n", num_vectors);
+		return false;
+	}
 
-				std::vector<int> vec = satgen.importSigSpec(chunksig, 1);
-				modelExpressions.insert(modelExpressions.end(), vec.begin(), vec.end());
+	// Prepare the replay of counter examples: compile the imported cells into a 256 lane
+	// simulator and collect the literals of all inputs in the cone of the proof condition.
+	// This is only done for the first counter example. A design the simulator can't handle
+	// is only reported if the replay was asked for explicitly.
+	bool prepare_replay(int prove_skip, bool verbose)
+	{
+		if (replay_state != 0)
+			return replay_state > 0;
+		replay_state = -1;
+
+		std::vector<RTLIL::Cell*> cells(show_driver_cells.begin(), show_driver_cells.end());
+		if (!replay_sim.compile(cells, sigmap)) {
+			if (verbose)
+				log("Counter examples will not be replayed: %s.\n", replay_sim.error.c_str());
+			else
+				log_debug("Counter examples will not be replayed: %s.\n", replay_sim.error.c_str());
+			return false;
+		}
 
-				if (enable_undef) {
-					std::vector<int> undef_vec = satgen.importUndefSigSpec(chunksig, 1);
-					modelUndefExpressions.insert(modelUndefExpressions.end(), undef_vec.begin(), undef_vec.end());
-				}
+		auto parse_pairs = [&](const std::vector<std::pair<std::string, std::string>> &pairs, std::vector<std::pair<int, int>> &ids) {
+			for (auto &s : pairs) {
+				RTLIL::SigSpec lhs, rhs;
+				if (!RTLIL::SigSpec::parse_sel(lhs, design, module, s.first) || !RTLIL::SigSpec::parse_rhs(lhs, rhs, module, s.second))
+					log_cmd_error("Failed to parse proof expression `%s'.\n", s.first.c_str());
+				lhs = sigmap(lhs), rhs = sigmap(rhs);
+				for (int i = 0; i < lhs.size(); i++)
+					ids.push_back(std::make_pair(replay_sim.bits(lhs[i]), replay_sim.bits(rhs[i])));
+			}
+		};
+		parse_pairs(prove, replay_prove);
+		parse_pairs(prove_x, replay_prove_x);
+		if (prove_asserts)
+			for (auto cell : cells)
+				if (cell->type == ID($assert))
+					replay_asserts.push_back(std::make_pair(replay_sim.bits(sigmap(cell->getPort(ID::A))[0]),
+							replay_sim.bits(sigmap(cell->getPort(ID::EN))[0])));
+
+		std::vector<int> roots;
+		for (auto &list : {replay_prove, replay_prove_x, replay_asserts})
+			for (auto &it : list) {
+				roots.push_back(it.first);
+				roots.push_back(it.second);
+			}
+		replay_sim.select_cone(roots);
+
+		replay_steps.clear();
+		if (max_timestep <= 0)
+			replay_steps.push_back(-1);
+		for (int t = 1; t <= max_timestep; t++)
+			replay_steps.push_back(t);
+
+		std::vector<int> value_lits, undef_lits;
+		replay_inputs.assign(GetSize(replay_steps), std::vector<std::pair<int, int>>());
+		for (int si = 0; si < GetSize(replay_steps); si++)
+			for (int id : replay_sim.cone_inputs) {
+				if (replay_sim.is_state[id] && si > 0)
+					continue;
+				replay_inputs[si].push_back(std::make_pair(id, GetSize(value_lits)));
+				value_lits.push_back(satgen.importSigSpec(replay_sim.bits[id], replay_steps[si]).front());
+				if (enable_undef)
+					undef_lits.push_back(satgen.importUndefSigSpec(replay_sim.bits[id], replay_steps[si]).front());
 			}
-		modelExpressions.insert(modelExpressions.end(), modelUndefExpressions.begin(), modelUndefExpressions.end());
+
+		replay_num_inputs = GetSize(value_lits);
+		replay_lits = value_lits;
+		replay_lits.insert(replay_lits.end(), undef_lits.begin(), undef_lits.end());
+		replay_prove_skip = prove_skip;
+		replay_state = 1;
+		return true;
 	}
 
-	void print_model()
+	// Replay the current model: simulate it with the input values from the solver and check
+	// that the proof condition fails. Undef inputs are X in lane 0 and random in the others.
+	void replay_counterexample(int prove_skip, bool verbose)
 	{
-		int maxModelName = 10;
-		int maxModelWidth = 10;
+		if (!prepare_replay(prove_skip, verbose))
+			return;
 
-		for (auto &info : modelInfo) {
-			maxModelName = max(maxModelName, int(info.description.size()));
-			maxModelWidth = max(maxModelWidth, info.width);
+		// the model doesn't contain the replay inputs, so solve again with the defined bits
+		// of the printed model fixed and read the inputs from that solution
+		std::vector<int> assumptions;
+		int width = modelValues.width;
+		for (int i = 0; i < width; i++) {
+			if (modelValues.get_undef(i))
+				continue;
+			assumptions.push_back(modelValues.get(i) ? modelExpressions[i] : ez->NOT(modelExpressions[i]));
+			if (enable_undef)
+				assumptions.push_back(ez->NOT(modelExpressions[width + i]));
 		}
 
-		log("\n");
+		SatModel printed_model;
+		printed_model.swap(modelValues);
+		extraExpressions = replay_lits;
+		bool success = solve(assumptions);
+		extraExpressions.clear();
+		printed_model.swap(modelValues);
+
+		if (!success) {
+			if (gotTimeout)
+				gotTimeout = false;
+			log("Counter example replay is inconclusive, the solver did not return the inputs of the model.\n");
+			return;
+		}
+		log_assert(GetSize(extraValues) == (enable_undef ? 2 : 1) * replay_num_inputs);
 
-		int last_timestep = -2;
-		for (auto &info : modelInfo)
-		{
-			RTLIL::Const value;
-			bool found_undef = false;
+		uint64_t rng = 0x2545f4914f6cdd1dull;
+		bool has_undef = false;
+		SimWord violated, unsure;
+		std::vector<SimWord> state_val, state_def;
 
-			for (int i = 0; i < info.width; i++) {
-				value.bits().push_back(modelValues.at(info.offset+i) ? RTLIL::State::S1 : RTLIL::State::S0);
-				if (enable_undef && modelValues.at(modelExpressions.size()/2 + info.offset + i))
-					value.bits().back() = RTLIL::State::Sx, found_undef = true;
+		for (int si = 0; si < GetSize(replay_steps); si++)
+		{
+			for (auto &it : replay_inputs[si]) {
+				SimWord v, d = ~SimWord();
+				if (enable_undef && extraValues[replay_num_inputs + it.second]) {
+					has_undef = true;
+					for (int i = 0; i < 4; i++) {
+						rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17;
+						v.w[i] = rng;
+					}
+					v.w[0] &= ~uint64_t(1), d.w[0] &= ~uint64_t(1);
+				} else if (extraValues[it.second])
+					v = ~SimWord();
+				replay_sim.val[it.first] = v, replay_sim.def[it.first] = d;
 			}
+			if (si > 0)
+				replay_sim.load_state(state_val, state_def);
+			replay_sim.eval();
+			replay_sim.save_state(state_val, state_def);
 
-			if (info.timestep != last_timestep) {
-				//const char *hline = "---------------------------------------------------------------------------------------------------"
-						  //  "---------------------------------------------------------------------------------------------------"
-						   // "---------------------------------------------------------------------------------------------------";
-				if (last_timestep == -2) {
-					//log(max_timestep > 0 ? "  Time " : "  ");
-					//log("%-*s %11s %9s %*s\n", maxModelName+5, "Signal Name", "Dec", "Hex", maxModelWidth+3, "Bin");
-				}
-				//log(max_timestep > 0 ? "  ---- " : "  ");
-				//log("%*.*s %11.11s %9.9s %*.*s\n", maxModelName+5, maxModelName+5,
-					//	hline, hline, hline, maxModelWidth+3, maxModelWidth+3, hline);
-				//last_timestep = info.timestep;
+			if (replay_steps[si] > 0 && replay_steps[si] <= replay_prove_skip)
+				continue;
+
+			const std::vector<SimWord> &v = replay_sim.val, &d = replay_sim.def;
+			for (auto &it : replay_prove) {
+				SimWord both_def = d[it.first] & d[it.second];
+				violated = violated | (both_def & (v[it.first] ^ v[it.second]));
+				unsure = unsure | ~both_def;
+			}
+			for (auto &it : replay_prove_x) {
+				violated = violated | (d[it.first] & d[it.second] & (v[it.first] ^ v[it.second]));
+				unsure = unsure | (d[it.first] & ~d[it.second]);
 			}
+			for (auto &it : replay_asserts) {
+				SimWord both_def = d[it.first] & d[it.second];
+				violated = violated | (both_def & v[it.second] & ~v[it.first]);
+				unsure = unsure | ~both_def;
+			}
+		}
 
-			if (max_timestep > 0) {
-				if (info.timestep > 0)
-					log("  %4d ", info.timestep);
+		if (violated.lane(0)) {
+			log("Counter example confirmed by simulation.\n");
+			return;
+		}
+
+		if (!unsure.lane(0)) {
+			log_warning("Simulating the counter example does not violate the proof condition!\n");
+			return;
+		}
+
+		if (has_undef) {
+			int count = 0;
+			for (int i = 1; i < 256; i++)
+				count += violated.lane(i);
+			log("Counter example replay is inconclusive due to undef values, %d of 255 random assignments to the undef inputs violate the proof condition.\n", count);
+		} else
+			log("Counter example replay is inconclusive due to undef values.\n");
+	}
+
+	void assume_failure(int property)
+	{
+		if (!minimize) {
+			ez->assume(ez->NOT(property));
+			return;
+		}
+		proof_property = property;
+		failure_act = ez->literal();
+		ez->assume(ez->OR(ez->NOT(failure_act), ez->NOT(property)));
+	}
+
+	// Deletion based minimization of assumptions that are unsatisfiable together with
+	// `fixed`: drop chunks of assumptions while the set stays unsatisfiable, halving the
+	// chunk size down to single literals. Returns false on timeout.
+	bool minimize_assumptions(std::vector<int> &assumptions, const std::vector<int> &fixed)
+	{
+		std::vector<bool> values;
+		for (int chunk = max(1, GetSize(assumptions) / 2);; chunk = max(1, chunk / 2))
+		{
+			for (int pos = 0; pos < GetSize(assumptions);)
+			{
+				std::vector<int> trial = fixed;
+				trial.insert(trial.end(), assumptions.begin(), assumptions.begin() + pos);
+				trial.insert(trial.end(), assumptions.begin() + min(pos + chunk, GetSize(assumptions)), assumptions.end());
+				if (solve_expressions(trial, std::vector<int>(), values))
+					pos += chunk;
+				else if (gotTimeout)
+					return false;
 				else
-					log("  init ");
-			} else
-				log("  ");
+					assumptions.erase(assumptions.begin() + pos, assumptions.begin() + min(pos + chunk, GetSize(assumptions)));
+			}
+			if (chunk == 1)
+				return true;
+		}
+	}
 
-			if (info.width <= 32 && !found_undef)
-				//log("%-*s %11d %9x %*s\n", maxModelName+5, info.description.c_str(), value.as_int(), value.as_int(), maxModelWidth+3, value.as_string().c_str());
-				log("%s=%s\n", info.description.c_str(), value.as_string().c_str());
+	// Find a small set of model inputs that forces the proof condition to fail when they are
+	// fixed to their values in the current model. All other inputs become undef in the model.
+	void minimize_cex()
+	{
+		log_assert(failure_act != 0);
+		if (gotTimeout)
+			return;
+
+		pool<RTLIL::SigBit> leaves;
+		for (auto bit : find_cone_leaves(show_signal_pool.export_all()))
+			leaves.insert(bit);
+
+		int width = modelValues.width;
+		std::vector<int> candidates, lits;
+		for (int i = 0; i < width; i++) {
+			if (model_bit_timesteps[i] != 0 && !leaves.count(model_bits[i]))
+				continue;
+			if (modelValues.get_undef(i))
+				continue;
+			int lit = modelValues.get(i) ? modelExpressions.at(i) : ez->NOT(modelExpressions.at(i));
+			if (enable_undef)
+				lit = ez->AND(lit, ez->NOT(modelExpressions.at(width + i)));
+			candidates.push_back(i);
+			lits.push_back(lit);
+		}
+
+		std::vector<int> fixed = {proof_property}, kept = lits;
+		fixed.insert(fixed.end(), active_selectors.begin(), active_selectors.end());
+		std::vector<bool> values;
+		std::vector<int> all = fixed;
+		all.insert(all.end(), lits.begin(), lits.end());
+		if (solve_expressions(all, std::vector<int>(), values)) {
+			log("Not minimizing the counter example: the shown input bits do not determine the failure.\n");
+			return;
+		}
+		if (gotTimeout || !minimize_assumptions(kept, fixed))
+			return;
+
+		pool<int> kept_lits(kept.begin(), kept.end());
+		for (int k = 0; k < GetSize(candidates); k++)
+			if (!kept_lits.count(lits[k]))
+				modelValues.set_undef(candidates[k], true);
+		log("Minimized counter example: %d of %d input bits are needed for the failure, the others are shown as undef.\n",
+				GetSize(kept_lits), GetSize(candidates));
+	}
+
+	// Report a small set of user constraints that is already unsatisfiable (together with
+	// the failure of the proof condition, if any), after a NO or proof SUCCESS result.
+	void print_unsat_core()
+	{
+		pool<int> core_candidates(core_selectors.begin(), core_selectors.end());
+		std::vector<int> fixed, core;
+		if (failure_act != 0)
+			fixed.push_back(failure_act);
+		for (int sel : active_selectors)
+			if (core_candidates.count(sel))
+				core.push_back(sel);
 			else
-				//log("%-*s %11s %9s %*s\n", maxModelName+5, info.description.c_str(), "--", "--", maxModelWidth+3, value.as_string().c_str());
-				log("%s=%s\n", info.description.c_str(), value.as_string().c_str());
+				fixed.push_back(sel);
+
+		if (!minimize_assumptions(core, fixed)) {
+			log("Timeout while minimizing the unsat core.\n");
+			return;
 		}
 
-		//if (last_timestep == -2)
-			//log("  no model variables selected for display.\n");
+		if (core.empty()) {
+			log("The problem is unsatisfiable without any of the %d user constraints.\n", GetSize(core_selectors));
+			return;
+		}
+
+		pool<int> core_set(core.begin(), core.end());
+		log("Unsat core (%d of %d user constraints):\n", GetSize(core), GetSize(core_selectors));
+		for (int i = 0; i < GetSize(core_selectors); i++)
+			if (core_set.count(core_selectors[i]))
+				log("  %s\n", core_descriptions[i].c_str());
 	}
 
-	void dump_model_to_vcd(std::string vcd_file_name)
+void maximize_undefs()
+{
+	log_assert(enable_undef);
+	SatModel backupValues;
+
+	prefilter_undefs(true);
+	if (gotTimeout)
+		return;
+
+// 	// === 第 1 阶段：只优化 X ===
+	std::vector<int> &must_undef = must_undef_scratch, &maybe_undef = maybe_undef_scratch;
+	while (true)
 	{
-		rewrite_filename(vcd_file_name);
-		FILE *f = fopen(vcd_file_name.c_str(), "w");
-		if (!f)
-			log_cmd_error("Can't open output file `%s' for writing: %s\n", vcd_file_name.c_str(), strerror(errno));
+		must_undef.clear();
+		maybe_undef.clear();
 
-		log("Dumping SAT model to VCD file %s\n", vcd_file_name.c_str());
+		for (size_t i = 0; i < modelExpressions.size() / 2; i++){
+			int expr = modelExpressions.at(modelExpressions.size() / 2 + i);
+			if (!x_lits.count(expr))
+				continue;
+			if (modelValues.get_undef(i))
+				must_undef.push_back(expr);
+			else
+				maybe_undef.push_back(expr);
+		}
+		// 进行一次解
+		backupValues.swap(modelValues);
+		if (!solve(ez->expression(ezSAT::OpAnd, must_undef), ez->expression(ezSAT::OpOr, maybe_undef)))
+			break;
+		// if(maybe_undef.empty()) {
+		// 	std::cout<<"All X signals successfully set to undef. Done.\n";
+		// 	return;
+		// }
+	}
+	backupValues.swap(modelValues);
+	prefilter_undefs(false);
+	if (gotTimeout)
+		return;
+	//=== 第 2 阶段：继续对 L 优化 ===
+		while (1)
+		{
+			must_undef.clear();
+			maybe_undef.clear();
 
-		time_t timestamp;
-		struct tm* now;
-		char stime[128] = {};
-		time(&timestamp);
-		now = localtime(&timestamp);
-		strftime(stime, sizeof(stime), "%c", now);
+			for (size_t i = 0; i < modelExpressions.size()/2; i++)
+			{	
+				if (modelValues.get_undef(i))
+					must_undef.push_back(modelExpressions.at(modelExpressions.size()/2 + i));
+				else
+					maybe_undef.push_back(modelExpressions.at(modelExpressions.size()/2 + i));
+			}
+			backupValues.swap(modelValues);
+			if (!solve(ez->expression(ezSAT::OpAnd, must_undef), ez->expression(ezSAT::OpOr, maybe_undef)))
+				break;
+		}
 
-		std::string module_fname = "unknown";
-		auto apos = module->attributes.find(ID::src);
-		if(apos != module->attributes.end())
-			module_fname = module->attributes[ID::src].decode_string();
+	backupValues.swap(modelValues);
+	
+}
 
-		fprintf(f, "$date\n");
-		fprintf(f, "    %s\n", stime);
-		fprintf(f, "$end\n");
-		fprintf(f, "$version\n");
-		fprintf(f, "    Generated by %s\n", yosys_maybe_version());
-		fprintf(f, "$end\n");
-		fprintf(f, "$comment\n");
-		fprintf(f, "    Generated from SAT problem in module %s (declared at %s)\n",
-			module->name.c_str(), module_fname.c_str());
-		fprintf(f, "$end\n");
+// 	void maximize_undefs()
+// 	{
+// 		log_assert(enable_undef);
+// 		std::vector<bool> backupValues;
+// 		std::vector<int> must_undef, maybe_undef;
+// 		while (1)
+// 		{
+// 			for (size_t i = 0; i < modelExpressions.size()/2; i++)
+// 			{	
+// 				if (modelValues.at(modelExpressions.size()/2 + i)){
+// 					int expr = modelExpressions.at(modelExpressions.size()/2 + i);
+// 					if (std::find(fuckingX.begin(), fuckingX.end(), expr) != fuckingX.end()) {
+// 					must_undef.push_back(expr);
+// 				}
+// 				}
+// 				else{
+// 					int expr = modelExpressions.at(modelExpressions.size()/2 + i);
+// 					if (std::find(fuckingX.begin(), fuckingX.end(), expr) != fuckingX.end()) {
+// 					maybe_undef.push_back(expr);
+// 				}
+// }
+// 			}
+// 			backupValues.swap(modelValues);
+// 			if (!solve(ez->expression(ezSAT::OpAnd, must_undef), ez->expression(ezSAT::OpOr, maybe_undef)))
+// 				break;
+// 			// if(maybe_undef.empty()) {
+// 			// std::cout<<"All X signals successfully set to undef. Done.\n";
+// 			// return;
+// 			// 	}	
+// 		}
+// 		backupValues.swap(modelValues);
+// 		// while (1)
+// 		// {
 
-		// VCD has some limits on internal (non-display) identifier names, so make legal ones
-		std::map<std::string, std::string> vcdnames;
+// 		// 	for (size_t i = 0; i < modelExpressions.size()/2; i++)	
+// 		// 		if (modelValues.at(modelExpressions.size()/2 + i))
+// 		// 			must_undef.push_back(modelExpressions.at(modelExpressions.size()/2 + i));
+// 		// 		else
+// 		// 			maybe_undef.push_back(modelExpressions.at(modelExpressions.size()/2 + i));
 
-		fprintf(f, "$scope module %s $end\n", module->name.c_str());
-		for (auto &info : modelInfo)
+// 		// 	backupValues.swap(modelValues);
+// 		// 	if (!solve(ez->expression(ezSAT::OpAnd, must_undef), ez->expression(ezSAT::OpOr, maybe_undef)))
+// 		// 		break;
+// 		// }
+
+
+// 		// backupValues.swap(modelValues);
+// 	}
+	// the returned reference is valid until the next call
+	const ModelLits &model_lits(const RTLIL::SigChunk &c, int timestep)
+	{
+		auto key = std::make_tuple(RTLIL::SigBit(c.wire, c.offset), c.width, timestep);
+		auto it = model_lit_cache.find(key);
+		if (it != model_lit_cache.end())
+			return it->second;
+
+		ModelLits &lits = model_lit_cache[key];
+		RTLIL::SigSpec chunksig = c;
+		lits.value = satgen.importSigSpec(chunksig, timestep);
+		if (enable_undef)
+			lits.undef = satgen.importUndefSigSpec(chunksig, timestep);
+		for (auto bit : sigmap(chunksig))
+			lits.bits.push_back(bit);
+		return lits;
+	}
+
+	// Build the model tables incrementally: the shown signals are selected once and every
+	// call only appends the time steps that were set up since the previous call. The tables
+	// are rebuilt from scratch if new set/prove signals were imported in the meantime.
+	void generate_model()
+	{
+		if (model_timestep == -2 || model_pool_size != show_signal_pool.size() || (model_timestep == -1 && max_timestep > 0))
+			reset_model();
+		int old_size = GetSize(modelValueExpressions);
+
+		for (int timestep = model_timestep + 1; timestep <= max_timestep; timestep++)
 		{
-			if (vcdnames.find(info.description) != vcdnames.end())
+			if ((timestep == -1 && max_timestep > 0) || timestep == 0)
 				continue;
 
-			char namebuf[16];
-			snprintf(namebuf, sizeof(namebuf), "v%d", static_cast<int>(vcdnames.size()));
-			vcdnames[info.description] = namebuf;
+			for (int ci = 0; ci < GetSize(model_chunks); ci++)
+			{
+				const RTLIL::SigChunk &c = model_chunks[ci];
+				string c_name = RTLIL::id2cstr(c.wire->name);
+				ModelBlockInfo info;
+				info.width = c.width;
+				info.name = model_chunk_names[ci];
+				info.timestep = timestep;
+				info.offset = modelValueExpressions.size();
+				modelInfo.push_back(info);
+				modelInfoSorted = false;
+
+				const ModelLits &lits = model_lits(c, timestep);
+				modelValueExpressions.insert(modelValueExpressions.end(), lits.value.begin(), lits.value.end());
+				model_bits.insert(model_bits.end(), lits.bits.begin(), lits.bits.end());
+				model_bit_timesteps.insert(model_bit_timesteps.end(), GetSize(lits.bits), timestep);
 
-			// Even display identifiers can't use some special characters
-			std::string legal_desc = info.description.c_str();
-			for (auto &c : legal_desc) {
-				if(c == '$')
-					c = '_';
-				if(c == ':')
-					c = '_';
+				if (enable_undef) {
+					const std::vector<int> &undef_vec = lits.undef;
+					if(c_name=="X"){
+						fuckingX.insert(fuckingX.end(), undef_vec.begin(), undef_vec.end());
+						x_lits.insert(undef_vec.begin(), undef_vec.end());
+					}
+					if(c_name=="L"){
+						fuckingL.insert(fuckingL.end(), undef_vec.begin(), undef_vec.end());
+					}
+					modelUndefExpressions.insert(modelUndefExpressions.end(), undef_vec.begin(), undef_vec.end());
+				}
 			}
+		}
+		model_timestep = max(model_timestep, max_timestep);
+
+		// the undef half follows all value bits, so only that layout needs a full rebuild
+		if (!enable_undef)
+			modelExpressions.insert(modelExpressions.end(), modelValueExpressions.begin() + old_size, modelValueExpressions.end());
+		else if (GetSize(modelValueExpressions) != old_size || modelExpressions.empty()) {
+			modelExpressions = modelValueExpressions;
+			modelExpressions.insert(modelExpressions.end(), modelUndefExpressions.begin(), modelUndefExpressions.end());
+		}
+	}
 
-			fprintf(f, "$var wire %d %s %s $end\n", info.width, namebuf, legal_desc.c_str());
+	// Find the leaves of the input cone of the given signals, i.e. the bits that are not
+	// driven by any imported cell. Uses a flat bit level driver index and a BFS over it.
+	RTLIL::SigSpec find_cone_leaves(const RTLIL::SigSpec &sig)
+	{
+		idict<RTLIL::SigBit> bit_ids;
+		std::vector<RTLIL::Cell*> cells(show_driver_cells.begin(), show_driver_cells.end());
 
-			// Need to look at first *two* cycles!
-			// We need to put a name on all variables but those without an initialization clause
-			// have no value at timestep 0
-			if(info.timestep > 1)
-				break;
+		// per cell: the bits the BFS continues with (all ports but the clock)
+		std::vector<int> cell_bits_start, cell_bits;
+		std::vector<std::pair<int, int>> driven_bits;
+
+		for (int ci = 0; ci < GetSize(cells); ci++)
+		{
+			RTLIL::Cell *cell = cells[ci];
+			cell_bits_start.push_back(GetSize(cell_bits));
+			for (auto &p : cell->connections()) {
+				bool is_output = ct.cell_output(cell->type, p.first);
+				if (!is_output && cell->type == ID($dff) && p.first == ID::CLK)
+					continue;
+				if (!is_output && cell->type.begins_with("$_DFF_") && p.first == ID::C)
+					continue;
+				for (auto bit : sigmap(p.second)) {
+					if (bit.wire == NULL)
+						continue;
+					int id = bit_ids(bit);
+					cell_bits.push_back(id);
+					if (is_output)
+						driven_bits.push_back(std::make_pair(id, ci));
+				}
+			}
 		}
-		fprintf(f, "$upscope $end\n");
-		fprintf(f, "$enddefinitions $end\n");
-		fprintf(f, "$dumpvars\n");
+		cell_bits_start.push_back(GetSize(cell_bits));
+
+		std::vector<int> queue;
+		for (auto bit : sigmap(sig))
+			if (bit.wire != NULL)
+				queue.push_back(bit_ids(bit));
+
+		int num_bits = GetSize(bit_ids);
+		std::vector<int> driver_start(num_bits + 1, 0), drivers(GetSize(driven_bits));
+		for (auto &it : driven_bits)
+			driver_start[it.first + 1]++;
+		for (int i = 0; i < num_bits; i++)
+			driver_start[i + 1] += driver_start[i];
+		std::vector<int> driver_fill(driver_start.begin(), driver_start.end() - 1);
+		for (auto &it : driven_bits)
+			drivers[driver_fill[it.first]++] = it.second;
+
+		std::vector<bool> visited(num_bits);
+		for (int id : queue)
+			visited[id] = true;
+
+		RTLIL::SigSpec leaves;
+		for (int qi = 0; qi < GetSize(queue); qi++)
+		{
+			int id = queue[qi];
+			if (driver_start[id] == driver_start[id + 1]) {
+				leaves.append(bit_ids[id]);
+				continue;
+			}
+			for (int di = driver_start[id]; di < driver_start[id + 1]; di++) {
+				int ci = drivers[di];
+				for (int i = cell_bits_start[ci]; i < cell_bits_start[ci + 1]; i++)
+					if (!visited[cell_bits[i]]) {
+						visited[cell_bits[i]] = true;
+						queue.push_back(cell_bits[i]);
+					}
+			}
+		}
+
+		return leaves;
+	}
+
+	void reset_model()
+	{
+		RTLIL::SigSpec modelSig;
+		modelExpressions.clear();
+		modelValueExpressions.clear();
+		modelUndefExpressions.clear();
+		model_bits.clear();
+		model_bit_timesteps.clear();
+		modelInfo.clear();
+		fuckingX.clear();
+		fuckingL.clear();
+		x_lits.clear();
+
+		// Add "show" signals or alternatively the leaves on the input cone on all set and prove signals
+
+		if (shows.size() == 0)
+		{
+			modelSig = find_cone_leaves(show_signal_pool.export_all());
+
+			// additionally add all set and prove signals directly
+			// (it improves user confidence if we write the constraints back ;-)
+			modelSig.append(show_signal_pool.export_all());
+		}
+		else
+		{
+			for (auto &s : shows) {
+				RTLIL::SigSpec sig;
+				if (!RTLIL::SigSpec::parse_sel(sig, design, module, s))
+					log_cmd_error("Failed to parse show expression `%s'.\n", s.c_str());
+				//log("Import show expression: %s\n", log_signal(sig));
+				modelSig.append(sig);
+			}
+		}
+
+		modelSig.sort_and_unify();
+		// log("Model signals: %s\n", log_signal(modelSig));
+
+		model_chunks.clear();
+		for (auto &c : modelSig.chunks())
+			if (c.wire != NULL)
+				model_chunks.push_back(c);
+		model_pool_size = show_signal_pool.size();
+		model_timestep = -2;
+
+		std::vector<RTLIL::SigChunk> init_chunks;
+		for (auto &c : satgen.initial_state.export_all().chunks())
+			if (c.wire != NULL)
+				init_chunks.push_back(c);
+
+		// intern the block names once, in sorted order
+		std::vector<std::pair<std::string, int>> names;
+		for (auto &c : model_chunks)
+			names.push_back(std::make_pair(std::string(log_signal(c)), c.width));
+		for (auto &c : init_chunks)
+			names.push_back(std::make_pair(std::string(log_signal(c)), c.width));
+		std::sort(names.begin(), names.end());
+		names.erase(std::unique(names.begin(), names.end()), names.end());
+
+		dict<std::string, int> name_ids;
+		modelNames.clear();
+		modelNameWidths.clear();
+		for (auto &it : names) {
+			name_ids[it.first] = GetSize(modelNames);
+			modelNames.push_back(it.first);
+			modelNameWidths.push_back(it.second);
+		}
+
+		model_chunk_names.clear();
+		for (auto &c : model_chunks)
+			model_chunk_names.push_back(name_ids.at(log_signal(c)));
+
+		// Add initial state signals as collected by satgen
+		//
+		for (auto &c : init_chunks)
+		{
+			ModelBlockInfo info;
+
+			info.timestep = 0;
+			info.offset = modelValueExpressions.size();
+			info.width = c.width;
+			info.name = name_ids.at(log_signal(c));
+			modelInfo.push_back(info);
+			modelInfoSorted = false;
+
+			const ModelLits &lits = model_lits(c, 1);
+			modelValueExpressions.insert(modelValueExpressions.end(), lits.value.begin(), lits.value.end());
+			model_bits.insert(model_bits.end(), lits.bits.begin(), lits.bits.end());
+			model_bit_timesteps.insert(model_bit_timesteps.end(), GetSize(lits.bits), 0);
+
+			if (enable_undef)
+				modelUndefExpressions.insert(modelUndefExpressions.end(), lits.undef.begin(), lits.undef.end());
+		}
+	}
+
+	const std::vector<ModelBlockInfo> &model_blocks()
+	{
+		if (!modelInfoSorted) {
+			std::sort(modelInfo.begin(), modelInfo.end());
+			modelInfoSorted = true;
+		}
+		return modelInfo;
+	}
+
+	// pack the bits of a model block into 64 bit words, LSB first
+	void model_block_words(const ModelBlockInfo &info, std::vector<uint64_t> &value, std::vector<uint64_t> &undef)
+	{
+		SatModel::extract(modelValues.value, info.offset, info.width, value);
+		SatModel::extract(modelValues.undef, info.offset, info.width, undef);
+	}
+
+	static std::string words_to_hex(const std::vector<uint64_t> &words, int width)
+	{
+		std::string hex;
+		for (int i = (width + 3) / 4 - 1; i >= 0; i--)
+			hex += "0123456789abcdef"[(words[i / 16] >> (4 * (i % 16))) & 15];
+		return hex;
+	}
+
+	// print the whole model as a single line of JSON: a table of [name, width] and one
+	// [timestep, name id, value, undef] entry per block with hex encoded bits
+	void print_model_json()
+	{
+		std::string json = "{\"names\": [";
+		for (int i = 0; i < GetSize(modelNames); i++) {
+			json += i ? ", [\"" : "[\"";
+			for (char c : modelNames[i]) {
+				if (c == '"' || c == '\\')
+					json += '\\';
+				json += c;
+			}
+			json += stringf("\", %d]", modelNameWidths[i]);
+		}
+		json += "], \"blocks\": [";
+
+		std::vector<uint64_t> value, undef;
+		bool first_block = true;
+		for (auto &info : model_blocks()) {
+			model_block_words(info, value, undef);
+			json += stringf("%s[%d, %d, \"%s\", \"%s\"]", first_block ? "" : ", ", info.timestep, info.name,
+					words_to_hex(value, info.width).c_str(), words_to_hex(undef, info.width).c_str());
+			first_block = false;
+		}
+		json += "]}";
+
+		log("%s\n", json.c_str());
+	}
+
+	void print_model()
+	{
+		ensure_model();
+		if (model_format == "json") {
+			print_model_json();
+			return;
+		}
+
+		int maxModelName = 10;
+		int maxModelWidth = 10;
+
+		for (int i = 0; i < GetSize(modelNames); i++) {
+			maxModelName = max(maxModelName, GetSize(modelNames[i]));
+			maxModelWidth = max(maxModelWidth, modelNameWidths[i]);
+		}
+
+		log("\n");
+
+		int last_timestep = -2;
+		for (auto &info : model_blocks())
+		{
+			const std::string &description = modelNames[info.name];
+			std::string value;
+			model_block_chars(info, value);
+			bool found_undef = value.find('x') != std::string::npos;
+
+			if (info.timestep != last_timestep) {
+				//const char *hline = "---------------------------------------------------------------------------------------------------"
+						  //  "---------------------------------------------------------------------------------------------------"
+						   // "---------------------------------------------------------------------------------------------------";
+				if (last_timestep == -2) {
+					//log(max_timestep > 0 ? "  Time " : "  ");
+					//log("%-*s %11s %9s %*s\n", maxModelName+5, "Signal Name", "Dec", "Hex", maxModelWidth+3, "Bin");
+				}
+				//log(max_timestep > 0 ? "  ---- " : "  ");
+				//log("%*.*s %11.11s %9.9s %*.*s\n", maxModelName+5, maxModelName+5,
+					//	hline, hline, hline, maxModelWidth+3, maxModelWidth+3, hline);
+				//last_timestep = info.timestep;
+			}
+
+			if (max_timestep > 0) {
+				if (info.timestep > 0)
+					log("  %4d ", info.timestep);
+				else
+					log("  init ");
+			} else
+				log("  ");
+
+			if (info.width <= 32 && !found_undef)
+				//log("%-*s %11d %9x %*s\n", maxModelName+5, description.c_str(), value.as_int(), value.as_int(), maxModelWidth+3, value.as_string().c_str());
+				log("%s=%s\n", description.c_str(), value.c_str());
+			else
+				//log("%-*s %11s %9s %*s\n", maxModelName+5, description.c_str(), "--", "--", maxModelWidth+3, value.as_string().c_str());
+				log("%s=%s\n", description.c_str(), value.c_str());
+		}
+
+		//if (last_timestep == -2)
+			//log("  no model variables selected for display.\n");
+	}
+
+	// format the bits of a model block MSB first, as used by the waveform writers
+	void model_block_chars(const ModelBlockInfo &info, std::string &value)
+	{
+		std::vector<uint64_t> value_words, undef_words;
+		model_block_words(info, value_words, undef_words);
+		value.resize(info.width);
+		for (int i = 0; i < info.width; i++) {
+			int k = info.width - 1 - i;
+			if ((undef_words[k / 64] >> (k % 64)) & 1)
+				value[i] = 'x';
+			else
+				value[i] = ((value_words[k / 64] >> (k % 64)) & 1) ? '1' : '0';
+		}
+	}
+
+	// even display identifiers can't use some special characters
+	static std::string legal_waveform_name(std::string name)
+	{
+		for (auto &c : name) {
+			if(c == '$')
+				c = '_';
+			if(c == ':')
+				c = '_';
+		}
+		return name;
+	}
+
+	void dump_model_to_vcd(std::string vcd_file_name)
+	{
+		ensure_model();
+		rewrite_filename(vcd_file_name);
+		FILE *f = fopen(vcd_file_name.c_str(), "w");
+		if (!f)
+			log_cmd_error("Can't open output file `%s' for writing: %s\n", vcd_file_name.c_str(), strerror(errno));
+
+		log("Dumping SAT model to VCD file %s\n", vcd_file_name.c_str());
+
+		time_t timestamp;
+		struct tm* now;
+		char stime[128] = {};
+		time(&timestamp);
+		now = localtime(&timestamp);
+		strftime(stime, sizeof(stime), "%c", now);
+
+		std::string module_fname = "unknown";
+		auto apos = module->attributes.find(ID::src);
+		if(apos != module->attributes.end())
+			module_fname = module->attributes[ID::src].decode_string();
+
+		fprintf(f, "$date\n");
+		fprintf(f, "    %s\n", stime);
+		fprintf(f, "$end\n");
+		fprintf(f, "$version\n");
+		fprintf(f, "    Generated by %s\n", yosys_maybe_version());
+		fprintf(f, "$end\n");
+		fprintf(f, "$comment\n");
+		fprintf(f, "    Generated from SAT problem in module %s (declared at %s)\n",
+			module->name.c_str(), module_fname.c_str());
+		fprintf(f, "$end\n");
+
+		// VCD has some limits on internal (non-display) identifier names, so make legal ones
+		std::vector<std::string> vcdnames(GetSize(modelNames));
+
+		fprintf(f, "$scope module %s $end\n", module->name.c_str());
+		for (int i = 0; i < GetSize(modelNames); i++)
+		{
+			vcdnames[i] = stringf("v%d", i);
+			std::string legal_desc = legal_waveform_name(modelNames[i]);
+			fprintf(f, "$var wire %d %s %s $end\n", modelNameWidths[i], vcdnames[i].c_str(), legal_desc.c_str());
+		}
+		fprintf(f, "$upscope $end\n");
+		fprintf(f, "$enddefinitions $end\n");
+		fprintf(f, "$dumpvars\n");
+
+		// the value changes are formatted into a large buffer that is written out in one
+		// go whenever it fills up. a variable is only written when its value changed.
+		const int buffer_size = 1 << 20;
+		std::string buffer, value;
+		std::vector<std::string> last_values(GetSize(modelNames));
+		buffer.reserve(buffer_size + 4096);
+
+		int last_timestep = -2;
+		for (auto &info : model_blocks())
+		{
+			model_block_chars(info, value);
+
+			if (info.timestep != last_timestep) {
+				if(last_timestep == 0)
+					buffer += "$end\n";
+				else
+					buffer += stringf("#%d\n", info.timestep);
+				last_timestep = info.timestep;
+			}
+
+			std::string &last_value = last_values[info.name];
+			if (value == last_value)
+				continue;
+			last_value = value;
+
+			if (info.width != 1)
+				buffer += 'b';
+			buffer += value;
+			if (info.width != 1)
+				buffer += ' ';
+			buffer += vcdnames[info.name];
+			buffer += '\n';
+
+			if (GetSize(buffer) >= buffer_size) {
+				fwrite(buffer.data(), 1, buffer.size(), f);
+				buffer.clear();
+			}
+		}
+
+		if (last_timestep == -2)
+			log("  no model variables selected for display.\n");
+
+		buffer += stringf("#%d\n", last_timestep+1);
+		fwrite(buffer.data(), 1, buffer.size(), f);
+		fclose(f);
+	}
+
+	void dump_model_to_fst(std::string fst_file_name)
+	{
+		ensure_model();
+		rewrite_filename(fst_file_name);
+		void *fst = fstWriterCreate(fst_file_name.c_str(), 1);
+		if (!fst)
+			log_cmd_error("Can't open output file `%s' for writing: %s\n", fst_file_name.c_str(), strerror(errno));
+
+		log("Dumping SAT model to FST file %s\n", fst_file_name.c_str());
+
+		std::string module_fname = "unknown";
+		auto apos = module->attributes.find(ID::src);
+		if(apos != module->attributes.end())
+			module_fname = module->attributes[ID::src].decode_string();
+
+		// LZ4 compressed value change blocks, repacked into a seekable file on close
+		fstWriterSetPackType(fst, FST_WR_PT_LZ4);
+		fstWriterSetRepackOnClose(fst, 1);
+		fstWriterSetVersion(fst, yosys_maybe_version());
+		fstWriterSetComment(fst, stringf("Generated from SAT problem in module %s (declared at %s)",
+				module->name.c_str(), module_fname.c_str()).c_str());
+
+		std::vector<fstHandle> handles(GetSize(modelNames));
+		fstWriterSetScope(fst, FST_ST_VCD_MODULE, module->name.c_str(), nullptr);
+		for (int i = 0; i < GetSize(modelNames); i++)
+			handles[i] = fstWriterCreateVar(fst, FST_VT_VCD_WIRE, FST_VD_IMPLICIT, modelNameWidths[i],
+					legal_waveform_name(modelNames[i]).c_str(), 0);
+		fstWriterSetUpscope(fst);
+
+		std::string value;
+		std::vector<std::string> last_values(GetSize(modelNames));
+
+		int last_timestep = -2;
+		for (auto &info : model_blocks())
+		{
+			if (info.timestep != last_timestep) {
+				fstWriterEmitTimeChange(fst, max(info.timestep, 0));
+				last_timestep = info.timestep;
+			}
+
+			model_block_chars(info, value);
+			if (value == last_values[info.name])
+				continue;
+			last_values[info.name] = value;
+			fstWriterEmitValueChange(fst, handles[info.name], value.c_str());
+		}
+
+		if (last_timestep == -2)
+			log("  no model variables selected for display.\n");
+
+		fstWriterEmitTimeChange(fst, max(last_timestep, 0) + 1);
+		fstWriterClose(fst);
+	}
+
+	// Packed binary model: "YSATMDL1", then u32 number of names, u32 number of blocks,
+	// per name u32 width, u32 length and the name characters, per block i32 timestep,
+	// u32 name id and the value and undef bits as (width+63)/64 u64 words each, LSB first.
+	// All integers are in host byte order. The file is written with a single fwrite().
+	void dump_model_to_bin(std::string bin_file_name)
+	{
+		ensure_model();
+		rewrite_filename(bin_file_name);
+		FILE *f = fopen(bin_file_name.c_str(), "wb");
+		if (!f)
+			log_cmd_error("Can't open output file `%s' for writing: %s\n", bin_file_name.c_str(), strerror(errno));
+
+		log("Dumping SAT model to binary file %s\n", bin_file_name.c_str());
+
+		std::string buffer = "YSATMDL1";
+		auto put_u32 = [&](uint32_t v) { buffer.append(reinterpret_cast<const char*>(&v), sizeof(v)); };
+		auto put_words = [&](const std::vector<uint64_t> &words) {
+			buffer.append(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint64_t));
+		};
+
+		const std::vector<ModelBlockInfo> &blocks = model_blocks();
+		put_u32(GetSize(modelNames));
+		put_u32(GetSize(blocks));
+		for (int i = 0; i < GetSize(modelNames); i++) {
+			put_u32(modelNameWidths[i]);
+			put_u32(GetSize(modelNames[i]));
+			buffer += modelNames[i];
+		}
+
+		std::vector<uint64_t> value, undef;
+		for (auto &info : blocks) {
+			model_block_words(info, value, undef);
+			put_u32(uint32_t(info.timestep));
+			put_u32(info.name);
+			put_words(value);
+			put_words(undef);
+		}
+
+		fwrite(buffer.data(), 1, buffer.size(), f);
+		fclose(f);
+	}
+
+	void dump_model_to_json(std::string json_file_name)
+	{
+		ensure_model();
+		rewrite_filename(json_file_name);
+		FILE *f = fopen(json_file_name.c_str(), "w");
+		if (!f)
+			log_cmd_error("Can't open output file `%s' for writing: %s\n", json_file_name.c_str(), strerror(errno));
+
+		log("Dumping SAT model to WaveJSON file '%s'.\n", json_file_name.c_str());
+
+		int mintime = 1, maxtime = 0, maxwidth = 0;;
+		dict<int, pair<int, dict<int, Const>>> wavedata;
+
+		for (auto &info : model_blocks())
+		{
+			std::string chars;
+			model_block_chars(info, chars);
+			Const value = Const::from_string(chars);
+
+			wavedata[info.name].first = info.width;
+			wavedata[info.name].second[info.timestep] = value;
+			mintime = min(mintime, info.timestep);
+			maxtime = max(maxtime, info.timestep);
+			maxwidth = max(maxwidth, info.width);
+		}
+
+		fprintf(f, "{ \"signal\": [");
+		bool fist_wavedata = true;
+		for (auto &wd : wavedata)
+		{
+			fprintf(f, "%s", fist_wavedata ? "\n" : ",\n");
+			fist_wavedata = false;
+
+			vector<string> data;
+			string name = modelNames[wd.first];
+			while (name.compare(0, 1, "\\") == 0)
+				name = name.substr(1);
+
+			fprintf(f, "    { \"name\": \"%s\", \"wave\": \"", name.c_str());
+			for (int i = mintime; i <= maxtime; i++) {
+				if (wd.second.second.count(i)) {
+					string this_data = wd.second.second[i].as_string();
+					char ch = '=';
+					if (wd.second.first == 1)
+						ch = this_data[0];
+					if (!data.empty() && data.back() == this_data) {
+						fprintf(f, ".");
+					} else {
+						data.push_back(this_data);
+						fprintf(f, "%c", ch);
+					}
+				} else {
+					data.push_back("");
+					fprintf(f, "4");
+				}
+			}
+			if (wd.second.first != 1) {
+				fprintf(f, "\", \"data\": [");
+				for (int i = 0; i < GetSize(data); i++)
+					 fprintf(f, "%s\"%s\"", i ? ", " : "", data[i].c_str());
+				fprintf(f, "] }");
+			} else {
+				fprintf(f, "\" }");
+			}
+		}
+		fprintf(f, "\n  ],\n");
+		fprintf(f, "  \"config\": {\n");
+		fprintf(f, "    \"hscale\": %.2f\n", maxwidth / 4.0);
+		fprintf(f, "  }\n");
+		fprintf(f, "}\n");
+		fclose(f);
+	}
+
+	void invalidate_model(bool max_undef)
+	{
+		std::vector<int> clause;
+		if (enable_undef) {
+			for (size_t i = 0; i < modelExpressions.size()/2; i++) {
+				int bit = modelExpressions.at(i), bit_undef = modelExpressions.at(modelExpressions.size()/2 + i);
+				bool val = modelValues.get(i), val_undef = modelValues.get_undef(i);
+				if (!max_undef || !val_undef)
+					clause.push_back(val_undef ? ez->NOT(bit_undef) : val ? ez->NOT(bit) : bit);
+			}
+		} else
+			for (size_t i = 0; i < modelExpressions.size(); i++)
+				clause.push_back(modelValues.get(i) ? ez->NOT(modelExpressions.at(i)) : modelExpressions.at(i));
+		ez->assume(ez->expression(ezSAT::OpOr, clause));
+	}
+};
+
+enum SatEngineResult { ENGINE_PROVEN, ENGINE_FAILED, ENGINE_UNKNOWN, ENGINE_TIMEOUT };
+
+// Property directed reachability (IC3) on top of the single time step encoding of SatHelper:
+// time steps 1 and 2 form the transition relation, the frames are clause sets over the state
+// bits of time step 1, each guarded by an activation literal so one solver serves all frames.
+struct SatPdr
+{
+	// a cube is a list of (state bit index << 1 | value)
+	typedef std::vector<int> Cube;
+
+	struct Obligation {
+		int level, depth;
+		Cube cube;
+		bool operator < (const Obligation &other) const {
+			// std::priority_queue pops the largest element, we want the lowest level first
+			if (level != other.level)
+				return level > other.level;
+			return depth < other.depth;
+		}
+	};
+
+	SatHelper &sat;
+	ezSAT *ez;
+	RTLIL::SigSpec state_signals;
+	std::vector<int> state1, state2;
+	RTLIL::Const init_values;
+	int property;
+
+	// frame_act[k] guards the clauses learned for frame k, frame 0 is the initial state
+	std::vector<int> frame_act;
+	std::vector<std::vector<Cube>> frame_cubes;
+	int cex_depth;
+
+	SatPdr(SatHelper &sat) : sat(sat), ez(sat.ez.get()), property(0), cex_depth(0) { }
+
+	int top() const
+	{
+		return GetSize(frame_act) - 1;
+	}
+
+	int lit(const std::vector<int> &state, int elem)
+	{
+		int l = state.at(elem >> 1);
+		return (elem & 1) ? l : ez->NOT(l);
+	}
+
+	bool query(const std::vector<int> &assumptions, const std::vector<int> &exprs, std::vector<bool> &values)
+	{
+		return sat.solve_expressions(assumptions, exprs, values);
+	}
+
+	void frame_assumptions(int k, std::vector<int> &assumptions)
+	{
+		if (k == 0) {
+			for (int i = 0; i < GetSize(state1); i++)
+				if (init_values[i] == State::S0 || init_values[i] == State::S1)
+					assumptions.push_back(init_values[i] == State::S1 ? state1[i] : ez->NOT(state1[i]));
+		} else {
+			for (int i = k; i <= top(); i++)
+				assumptions.push_back(frame_act[i]);
+		}
+	}
+
+	Cube model_cube(const std::vector<bool> &values)
+	{
+		Cube cube;
+		for (int i = 0; i < GetSize(values); i++)
+			cube.push_back(i << 1 | (values[i] ? 1 : 0));
+		return cube;
+	}
+
+	bool intersects_init(const Cube &cube)
+	{
+		for (int elem : cube) {
+			RTLIL::State v = init_values[elem >> 1];
+			if ((v == State::S0 && (elem & 1)) || (v == State::S1 && !(elem & 1)))
+				return false;
+		}
+		return true;
+	}
+
+	// is F[k-1] & !cube & T & cube' satisfiable? optionally return the predecessor state
+	bool has_predecessor(const Cube &cube, int k, Cube *pred)
+	{
+		std::vector<int> assumptions, clause;
+		frame_assumptions(k-1, assumptions);
+		for (int elem : cube) {
+			clause.push_back(ez->NOT(lit(state1, elem)));
+			assumptions.push_back(lit(state2, elem));
+		}
+
+		int act = ez->literal();
+		ez->assume(ez->OR(ez->NOT(act), ez->expression(ezSAT::OpOr, clause)));
+		assumptions.push_back(act);
+
+		std::vector<bool> values;
+		bool success = query(assumptions, state1, values);
+		ez->assume(ez->NOT(act));
+
+		if (success && pred != nullptr)
+			*pred = model_cube(values);
+		return success;
+	}
+
+	// drop literals from a predecessor cube as long as all of its states reach `succ` for all
+	// inputs, so that the obligation covers more than the single state of the model
+	Cube lift(const Cube &pred, const Cube &succ)
+	{
+		std::vector<int> clause;
+		for (int elem : succ)
+			clause.push_back(ez->NOT(lit(state2, elem)));
+		int act = ez->literal();
+		ez->assume(ez->OR(ez->NOT(act), ez->expression(ezSAT::OpOr, clause)));
+
+		Cube result = pred;
+		std::vector<bool> values;
+		for (int i = 0; i < GetSize(result) && !sat.gotTimeout; )
+		{
+			Cube candidate = result;
+			candidate.erase(candidate.begin() + i);
+			std::vector<int> assumptions(1, act);
+			for (int elem : candidate)
+				assumptions.push_back(lit(state1, elem));
+			if (!query(assumptions, std::vector<int>(), values) && !sat.gotTimeout)
+				result.swap(candidate);
+			else
+				i++;
+		}
+
+		ez->assume(ez->NOT(act));
+		return result;
+	}
+
+	void add_blocked(const Cube &cube, int k)
+	{
+		std::vector<int> clause;
+		for (int elem : cube)
+			clause.push_back(ez->NOT(lit(state1, elem)));
+		ez->assume(ez->OR(ez->NOT(frame_act[k]), ez->expression(ezSAT::OpOr, clause)));
+		frame_cubes[k].push_back(cube);
+	}
+
+	// drop literals from the cube as long as it stays blocked relative to frame k-1
+	Cube generalize(const Cube &cube, int k)
+	{
+		Cube result = cube;
+		for (int i = 0; i < GetSize(result) && GetSize(result) > 1 && !sat.gotTimeout; )
+		{
+			Cube candidate = result;
+			candidate.erase(candidate.begin() + i);
+			if (!intersects_init(candidate) && !has_predecessor(candidate, k, nullptr) && !sat.gotTimeout)
+				result.swap(candidate);
+			else
+				i++;
+		}
+		return result;
+	}
+
+	void new_frame()
+	{
+		frame_act.push_back(ez->literal());
+		frame_cubes.push_back(std::vector<Cube>());
+	}
+
+	// block a bad state in the top frame, returns false if it is reachable
+	bool block(const Cube &bad)
+	{
+		std::priority_queue<Obligation> queue;
+		queue.push(Obligation{top(), 0, bad});
+
+		while (!queue.empty())
+		{
+			Obligation ob = queue.top();
+
+			if (ob.level == 0) {
+				cex_depth = ob.depth + 1;
+				return false;
+			}
+
+			// blocking a cube requires that it contains no initial state
+			if (intersects_init(ob.cube)) {
+				cex_depth = ob.depth + 1;
+				return false;
+			}
+
+			Cube pred;
+			if (has_predecessor(ob.cube, ob.level, &pred)) {
+				pred = lift(pred, ob.cube);
+				if (sat.gotTimeout)
+					return true;
+				queue.push(Obligation{ob.level - 1, ob.depth + 1, pred});
+				continue;
+			}
+			if (sat.gotTimeout)
+				return true;
+
+			queue.pop();
+			Cube cube = generalize(ob.cube, ob.level);
+			if (sat.gotTimeout)
+				return true;
+
+			add_blocked(cube, ob.level);
+			if (ob.level < top())
+				queue.push(Obligation{ob.level + 1, ob.depth, ob.cube});
+		}
+
+		return true;
+	}
+
+	// push learned clauses forward, returns true if a frame became inductive
+	bool propagate()
+	{
+		for (int k = 1; k < top(); k++)
+		{
+			std::vector<Cube> cubes;
+			cubes.swap(frame_cubes[k]);
+
+			for (auto &cube : cubes)
+			{
+				std::vector<int> assumptions;
+				std::vector<bool> values;
+				frame_assumptions(k, assumptions);
+				for (int elem : cube)
+					assumptions.push_back(lit(state2, elem));
+
+				if (!query(assumptions, std::vector<int>(), values) && !sat.gotTimeout)
+					add_blocked(cube, k+1);
+				else
+					frame_cubes[k].push_back(cube);
+
+				if (sat.gotTimeout)
+					return false;
+			}
+
+			if (frame_cubes[k].empty()) {
+				log("PDR: frame %d is inductive.\n", k);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	SatEngineResult run(int max_frames)
+	{
+		// $initstate is an extra state bit that is only set in the initial frame, so the
+		// initial frame sees the same logic as time step 1 of a -seq problem
+		int initstate1 = ez->literal(), initstate2 = ez->literal();
+		sat.initstate_lits[1] = initstate1;
+		sat.initstate_lits[2] = initstate2;
+		sat.setup(1);
+		sat.setup(2);
+		ez->assume(ez->NOT(initstate2));
+		property = sat.setup_proof(1);
+
+		state_signals = sat.satgen.initial_state.export_all();
+		state1 = sat.satgen.importSigSpec(state_signals, 1);
+		state2 = sat.satgen.importSigSpec(state_signals, 2);
+		init_values = sat.get_init_values(state_signals);
+		state1.push_back(initstate1);
+		state2.push_back(initstate2);
+		init_values.bits().push_back(State::S1);
+
+		int init_bits = 0;
+		for (int i = 0; i < GetSize(state_signals); i++)
+			if (init_values[i] == State::S0 || init_values[i] == State::S1)
+				init_bits++;
+		log("\nPDR: %d state bits, %d of them with initial value.\n", GetSize(state_signals), init_bits);
+
+		std::vector<int> assumptions;
+		std::vector<bool> values;
+
+		frame_assumptions(0, assumptions);
+		assumptions.push_back(ez->NOT(property));
+		if (query(assumptions, std::vector<int>(), values)) {
+			cex_depth = 1;
+			return ENGINE_FAILED;
+		}
+		if (sat.gotTimeout)
+			return ENGINE_TIMEOUT;
+
+		frame_act.push_back(0);
+		frame_cubes.push_back(std::vector<Cube>());
+		new_frame();
+
+		while (1)
+		{
+			while (1) {
+				assumptions.clear();
+				frame_assumptions(top(), assumptions);
+				assumptions.push_back(ez->NOT(property));
+				if (!query(assumptions, state1, values))
+					break;
+				if (!block(model_cube(values)))
+					return ENGINE_FAILED;
+				if (sat.gotTimeout)
+					return ENGINE_TIMEOUT;
+			}
+			if (sat.gotTimeout)
+				return ENGINE_TIMEOUT;
+
+			int num_clauses = 0;
+			for (auto &cubes : frame_cubes)
+				num_clauses += GetSize(cubes);
+			log("PDR: frame %d blocked, %d clauses in all frames.\n", top(), num_clauses);
+			log_flush();
+
+			if (max_frames > 0 && top() >= max_frames)
+				return ENGINE_UNKNOWN;
+
+			new_frame();
+			if (propagate())
+				return ENGINE_PROVEN;
+			if (sat.gotTimeout)
+				return ENGINE_TIMEOUT;
+		}
+	}
+};
+
+// Interpolation based model checking (McMillan 2003). ezSAT has no proof logging, so the
+// interpolants are computed without proofs: image states of the A side are enumerated and
+// each one is generalized to a cube that is still inconsistent with the B side. The
+// disjunction of these cubes is implied by A and inconsistent with B, i.e. an interpolant.
+struct SatItp
+{
+	// a cube is a list of (state bit index << 1 | value)
+	typedef std::vector<int> Cube;
+
+	// image: R(s1) & T(s1, s2), bmc: a bad state within the bound, starting at time step 1
+	SatHelper &image, &bmc;
+	std::vector<int> image_state1, image_state2, bmc_state;
+	RTLIL::Const init_values;
+	std::vector<int> bmc_props;
+	std::vector<Cube> reached;
+	int bad_act, cex_depth;
+
+	SatItp(SatHelper &image, SatHelper &bmc) : image(image), bmc(bmc), bad_act(0), cex_depth(0) { }
+
+	bool timed_out() const
+	{
+		return image.gotTimeout || bmc.gotTimeout;
+	}
+
+	static void cube_lits(ezSAT *ez, const std::vector<int> &state, const Cube &cube, std::vector<int> &lits)
+	{
+		for (int elem : cube)
+			lits.push_back((elem & 1) ? state.at(elem >> 1) : ez->NOT(state.at(elem >> 1)));
+	}
+
+	static int dnf_expr(ezSAT *ez, const std::vector<int> &state, const std::vector<Cube> &cubes)
+	{
+		std::vector<int> terms;
+		for (auto &cube : cubes) {
+			std::vector<int> lits;
+			cube_lits(ez, state, cube, lits);
+			terms.push_back(ez->expression(ezSAT::OpAnd, lits));
+		}
+		return ez->expression(ezSAT::OpOr, terms);
+	}
+
+	static Cube model_cube(const std::vector<bool> &values)
+	{
+		Cube cube;
+		for (int i = 0; i < GetSize(values); i++)
+			cube.push_back(i << 1 | (values[i] ? 1 : 0));
+		return cube;
+	}
+
+	// can a state in the cube reach a bad state within the current bound?
+	bool reaches_bad(const Cube &cube)
+	{
+		std::vector<int> assumptions;
+		std::vector<bool> values;
+		cube_lits(bmc.ez.get(), bmc_state, cube, assumptions);
+		assumptions.push_back(bad_act);
+		return bmc.solve_expressions(assumptions, std::vector<int>(), values);
+	}
+
+	Cube generalize(const Cube &cube)
+	{
+		Cube result = cube;
+		for (int i = 0; i < GetSize(result) && !timed_out(); )
+		{
+			Cube candidate = result;
+			candidate.erase(candidate.begin() + i);
+			if (!reaches_bad(candidate) && !timed_out())
+				result.swap(candidate);
+			else
+				i++;
+		}
+		return result;
+	}
+
+	// compute an interpolant between the image of the reached states and the states that
+	// reach a bad state within the bound. returns false if the two are consistent.
+	bool interpolate(std::vector<Cube> &itp)
+	{
+		ezSAT *ez = image.ez.get();
+		int reach_act = ez->literal(), itp_act = ez->literal();
+		ez->assume(ez->OR(ez->NOT(reach_act), dnf_expr(ez, image_state1, reached)));
 
-		static const char bitvals[] = "01xzxx";
+		bool consistent = false;
+		std::vector<bool> values;
 
-		int last_timestep = -2;
-		for (auto &info : modelInfo)
+		while (image.solve_expressions({reach_act, itp_act}, image_state2, values))
 		{
-			RTLIL::Const value;
-
-			for (int i = 0; i < info.width; i++) {
-				value.bits().push_back(modelValues.at(info.offset+i) ? RTLIL::State::S1 : RTLIL::State::S0);
-				if (enable_undef && modelValues.at(modelExpressions.size()/2 + info.offset + i))
-					value.bits().back() = RTLIL::State::Sx;
+			Cube cube = model_cube(values);
+			if (reaches_bad(cube)) {
+				consistent = true;
+				break;
 			}
+			if (timed_out())
+				break;
 
-			if (info.timestep != last_timestep) {
-				if(last_timestep == 0)
-					fprintf(f, "$end\n");
-				else
-					fprintf(f, "#%d\n", info.timestep);
-				last_timestep = info.timestep;
-			}
+			cube = generalize(cube);
+			if (timed_out())
+				break;
 
-			if(info.width == 1) {
-				fprintf(f, "%c%s\n", bitvals[value[0]], vcdnames[info.description].c_str());
-			} else {
-				fprintf(f, "b");
-				for(int k=info.width-1; k >= 0; k --)	//need to flip bit ordering for VCD
-					fprintf(f, "%c", bitvals[value[k]]);
-				fprintf(f, " %s\n", vcdnames[info.description].c_str());
-			}
+			std::vector<int> lits;
+			cube_lits(ez, image_state2, cube, lits);
+			ez->assume(ez->OR(ez->NOT(itp_act), ez->NOT(ez->expression(ezSAT::OpAnd, lits))));
+			itp.push_back(cube);
 		}
 
-		if (last_timestep == -2)
-			log("  no model variables selected for display.\n");
-
-		fprintf(f, "#%d\n", last_timestep+1);
-		fclose(f);
+		ez->assume(ez->NOT(reach_act));
+		ez->assume(ez->NOT(itp_act));
+		return !consistent;
 	}
 
-	void dump_model_to_json(std::string json_file_name)
+	// is every state of the interpolant already in the reached set?
+	bool contained(const std::vector<Cube> &itp)
 	{
-		rewrite_filename(json_file_name);
-		FILE *f = fopen(json_file_name.c_str(), "w");
-		if (!f)
-			log_cmd_error("Can't open output file `%s' for writing: %s\n", json_file_name.c_str(), strerror(errno));
-
-		log("Dumping SAT model to WaveJSON file '%s'.\n", json_file_name.c_str());
-
-		int mintime = 1, maxtime = 0, maxwidth = 0;;
-		dict<string, pair<int, dict<int, Const>>> wavedata;
+		ezSAT *ez = image.ez.get();
+		int act = ez->literal();
+		ez->assume(ez->OR(ez->NOT(act), ez->NOT(dnf_expr(ez, image_state1, reached))));
 
-		for (auto &info : modelInfo)
+		bool result = true;
+		for (auto &cube : itp)
 		{
-			Const value;
-			for (int i = 0; i < info.width; i++) {
-				value.bits().push_back(modelValues.at(info.offset+i) ? RTLIL::State::S1 : RTLIL::State::S0);
-				if (enable_undef && modelValues.at(modelExpressions.size()/2 + info.offset + i))
-					value.bits().back() = RTLIL::State::Sx;
+			std::vector<int> assumptions(1, act);
+			std::vector<bool> values;
+			cube_lits(ez, image_state1, cube, assumptions);
+			if (image.solve_expressions(assumptions, std::vector<int>(), values) || timed_out()) {
+				result = false;
+				break;
 			}
-
-			wavedata[info.description].first = info.width;
-			wavedata[info.description].second[info.timestep] = value;
-			mintime = min(mintime, info.timestep);
-			maxtime = max(maxtime, info.timestep);
-			maxwidth = max(maxwidth, info.width);
 		}
 
-		fprintf(f, "{ \"signal\": [");
-		bool fist_wavedata = true;
-		for (auto &wd : wavedata)
+		ez->assume(ez->NOT(act));
+		return result;
+	}
+
+	SatEngineResult run(int max_bound)
+	{
+		// $initstate is an extra state bit that is only set in the initial states, as in SatPdr
+		int image_initstate1 = image.ez->literal(), image_initstate2 = image.ez->literal();
+		image.initstate_lits[1] = image_initstate1;
+		image.initstate_lits[2] = image_initstate2;
+		image.setup(1);
+		image.setup(2);
+		image.ez->assume(image.ez->NOT(image_initstate2));
+
+		RTLIL::SigSpec state_signals = image.satgen.initial_state.export_all();
+		image_state1 = image.satgen.importSigSpec(state_signals, 1);
+		image_state2 = image.satgen.importSigSpec(state_signals, 2);
+		init_values = image.get_init_values(state_signals);
+		image_state1.push_back(image_initstate1);
+		image_state2.push_back(image_initstate2);
+
+		int bmc_initstate = bmc.ez->literal();
+		bmc.initstate_lits[1] = bmc_initstate;
+		bmc.setup(1);
+		bmc_state = bmc.satgen.importSigSpec(bmc.satgen.initial_state.export_all(), 1);
+		bmc_state.push_back(bmc_initstate);
+		log_assert(GetSize(bmc_state) == GetSize(image_state1));
+
+		Cube init_cube;
+		for (int i = 0; i < GetSize(init_values); i++)
+			if (init_values[i] == State::S0 || init_values[i] == State::S1)
+				init_cube.push_back(i << 1 | (init_values[i] == State::S1 ? 1 : 0));
+		int num_init_bits = GetSize(init_cube);
+		init_cube.push_back(GetSize(state_signals) << 1 | 1);
+
+		log("\nITP: %d state bits, %d of them with initial value.\n", GetSize(state_signals), num_init_bits);
+
+		for (int k = 1; max_bound == 0 || k <= max_bound; k++)
 		{
-			fprintf(f, "%s", fist_wavedata ? "\n" : ",\n");
-			fist_wavedata = false;
+			ezSAT *ez = bmc.ez.get();
+			if (k > 1)
+				bmc.setup(k);
+			bmc_props.push_back(bmc.setup_proof(k));
+
+			std::vector<int> bad_bits;
+			for (int prop : bmc_props)
+				bad_bits.push_back(ez->NOT(prop));
+			bad_act = ez->literal();
+			ez->assume(ez->OR(ez->NOT(bad_act), ez->expression(ezSAT::OpOr, bad_bits)));
+
+			if (reaches_bad(init_cube)) {
+				cex_depth = k;
+				return ENGINE_FAILED;
+			}
+			if (timed_out())
+				return ENGINE_TIMEOUT;
 
-			vector<string> data;
-			string name = wd.first.c_str();
-			while (name.compare(0, 1, "\\") == 0)
-				name = name.substr(1);
+			reached.assign(1, init_cube);
 
-			fprintf(f, "    { \"name\": \"%s\", \"wave\": \"", name.c_str());
-			for (int i = mintime; i <= maxtime; i++) {
-				if (wd.second.second.count(i)) {
-					string this_data = wd.second.second[i].as_string();
-					char ch = '=';
-					if (wd.second.first == 1)
-						ch = this_data[0];
-					if (!data.empty() && data.back() == this_data) {
-						fprintf(f, ".");
-					} else {
-						data.push_back(this_data);
-						fprintf(f, "%c", ch);
+			for (int iter = 1;; iter++)
+			{
+				std::vector<Cube> itp;
+				bool found = interpolate(itp);
+				if (timed_out())
+					return ENGINE_TIMEOUT;
+
+				if (!found) {
+					if (iter == 1) {
+						cex_depth = k + 1;
+						return ENGINE_FAILED;
 					}
-				} else {
-					data.push_back("");
-					fprintf(f, "4");
+					log("ITP: bound %d: over-approximation reaches a bad state after %d images, increasing bound.\n", k, iter-1);
+					break;
 				}
-			}
-			if (wd.second.first != 1) {
-				fprintf(f, "\", \"data\": [");
-				for (int i = 0; i < GetSize(data); i++)
-					 fprintf(f, "%s\"%s\"", i ? ", " : "", data[i].c_str());
-				fprintf(f, "] }");
-			} else {
-				fprintf(f, "\" }");
+
+				log("ITP: bound %d, image %d: interpolant with %d cubes.\n", k, iter, GetSize(itp));
+				log_flush();
+
+				bool fixpoint = contained(itp);
+				if (timed_out())
+					return ENGINE_TIMEOUT;
+				if (fixpoint) {
+					log("ITP: reached set is closed under the image after %d images.\n", iter);
+					return ENGINE_PROVEN;
+				}
+				reached.insert(reached.end(), itp.begin(), itp.end());
 			}
 		}
-		fprintf(f, "\n  ],\n");
-		fprintf(f, "  \"config\": {\n");
-		fprintf(f, "    \"hscale\": %.2f\n", maxwidth / 4.0);
-		fprintf(f, "  }\n");
-		fprintf(f, "}\n");
-		fclose(f);
-	}
 
-	void invalidate_model(bool max_undef)
-	{
-		std::vector<int> clause;
-		if (enable_undef) {
-			for (size_t i = 0; i < modelExpressions.size()/2; i++) {
-				int bit = modelExpressions.at(i), bit_undef = modelExpressions.at(modelExpressions.size()/2 + i);
-				bool val = modelValues.at(i), val_undef = modelValues.at(modelExpressions.size()/2 + i);
-				if (!max_undef || !val_undef)
-					clause.push_back(val_undef ? ez->NOT(bit_undef) : val ? ez->NOT(bit) : bit);
-			}
-		} else
-			for (size_t i = 0; i < modelExpressions.size(); i++)
-				clause.push_back(modelValues.at(i) ? ez->NOT(modelExpressions.at(i)) : modelExpressions.at(i));
-		ez->assume(ez->expression(ezSAT::OpOr, clause));
+		return ENGINE_UNKNOWN;
 	}
 };
 
@@ -996,6 +3711,83 @@ void print_qed()
 	log("\n");
 }
 
+// Notes netlist changes of the module of a SAT session (of any module with -hier), after
+// which the encoding of the session no longer matches the design.
+struct SatSessionMonitor : public RTLIL::Monitor
+{
+	RTLIL::Module *module;
+	bool hier, changed = false;
+
+	SatSessionMonitor(RTLIL::Module *module, bool hier) : module(module), hier(hier) { }
+
+	void notify_module_add(RTLIL::Module*) override {
+		changed |= hier;
+	}
+	void notify_module_del(RTLIL::Module *mod) override {
+		changed |= hier || mod == module;
+	}
+	void notify_connect(RTLIL::Cell *cell, const RTLIL::IdString&, const RTLIL::SigSpec&, const RTLIL::SigSpec&) override {
+		changed |= hier || cell->module == module;
+	}
+	void notify_connect(RTLIL::Module *mod, const RTLIL::SigSig&) override {
+		changed |= hier || mod == module;
+	}
+	void notify_connect(RTLIL::Module *mod, const std::vector<RTLIL::SigSig>&) override {
+		changed |= hier || mod == module;
+	}
+	void notify_blackout(RTLIL::Module *mod) override {
+		changed |= hier || mod == module;
+	}
+};
+
+// Open SAT sessions (sat -session), at most one per design. The name of the module is also
+// recorded as "sat.session" in the scratchpad of the design. A session remembers the module
+// by name and identity, together with a monitor and the size of the module, so a query can
+// refuse to run on an encoding that no longer matches the design.
+struct SatSession {
+	std::unique_ptr<SatHelper> helper;
+	std::unique_ptr<SatSessionMonitor> monitor;
+	int seq_len = 0;
+	unsigned int design_hashidx = 0, module_hashidx = 0;
+	RTLIL::IdString module_name;
+	int num_wires = 0, num_cells = 0, num_connections = 0;
+	SigPool show_signals;
+};
+
+static std::map<RTLIL::Design*, SatSession> sat_sessions;
+
+// Destroyed designs don't notify anyone, so an entry whose design was freed is only noticed
+// when a new design shows up at the same address. Such entries are dropped without touching
+// the old design.
+static SatSession *find_sat_session(RTLIL::Design *design)
+{
+	auto it = sat_sessions.find(design);
+	if (it == sat_sessions.end())
+		return nullptr;
+	if (it->second.design_hashidx != design->hashidx_) {
+		sat_sessions.erase(it);
+		return nullptr;
+	}
+	return &it->second;
+}
+
+static void close_sat_session(RTLIL::Design *design)
+{
+	SatSession *session = find_sat_session(design);
+	log_assert(session != nullptr);
+	design->monitors.erase(session->monitor.get());
+	design->scratchpad_unset("sat.session");
+	sat_sessions.erase(design);
+}
+
+static bool sat_session_changed(RTLIL::Design *design, const SatSession &session)
+{
+	RTLIL::Module *module = design->module(session.module_name);
+	return session.monitor->changed || module == nullptr || module->hashidx_ != session.module_hashidx ||
+			GetSize(module->wires_) != session.num_wires || GetSize(module->cells_) != session.num_cells ||
+			GetSize(module->connections()) != session.num_connections;
+}
+
 struct SatPass : public Pass {
 	SatPass() : Pass("sat", "solve a SAT problem in the circuit") { }
 	void help() override
@@ -1053,9 +3845,36 @@ struct SatPass : public Pass {
 		log("    -ignore_div_by_zero\n");
 		log("        ignore all solutions that involve a division by zero\n");
 		log("\n");
+		log("    -hier\n");
+		log("        Support cells that instantiate other modules of the design. Each such\n");
+		log("        module is encoded once into a CNF template that is instantiated for\n");
+		log("        every cell and time step. If more than one module is selected, the top\n");
+		log("        of the selected hierarchy is used. The only sequential cells supported\n");
+		log("        in submodules are $dff, $ff, $_DFF_P_, $_DFF_N_ and $_FF_. Their state\n");
+		log("        is kept per instance and starts from the init attributes and the\n");
+		log("        -set-init-zero/-def/-undef options, but it can't be set with -set-init\n");
+		log("        and isn't shown in the model. Sequential submodules are not supported\n");
+		log("        with -tempinduct, -pdr and -itp, whose state vectors don't cover them.\n");
+		log("\n");
+		log("    -threads <N>\n");
+		log("        Encode the simple gates ($_AND_, $and, $mux, ...) with <N> worker\n");
+		log("        threads. The clauses are built once and added for each time step,\n");
+		log("        other cells are imported as usual. Without effect with -enable_undef.\n");
+		log("\n");
 		log("    -ignore_unknown_cells\n");
 		log("        ignore all cells that can not be matched to a SAT model\n");
 		log("\n");
+		log("    -session open|query|close\n");
+		log("        Keep the encoded problem alive between calls of the pass. 'open' sets\n");
+		log("        up the circuit with the given options (including -seq) and stores it\n");
+		log("        with the design. 'query' solves the open problem with the -set,\n");
+		log("        -set-at, -prove, -prove-x and -prove-asserts options of this call, which\n");
+		log("        are only added for this query (the -prove options of 'open' are used if\n");
+		log("        the query has none). -verify, -falsify, -timeout, -prove-skip,\n");
+		log("        -model-format and the -dump_* options also apply to a query, options\n");
+		log("        that change the encoding are rejected. A query fails if the module was\n");
+		log("        changed after 'open'. 'close' frees the session.\n");
+		log("\n");
 		log("The following options can be used to set up a sequential problem:\n");
 		log("\n");
 		log("    -seq <N>\n");
@@ -1065,6 +3884,12 @@ struct SatPass : public Pass {
 		log("        note: for large <N> it can be significantly faster to use\n");
 		log("        -tempinduct-baseonly -maxsteps <N> instead of -seq <N>.\n");
 		log("\n");
+		log("    -seq-incremental\n");
+		log("        unroll the -seq problem one time step at a time and check the proof\n");
+		log("        condition of each time step separately, reusing the solver state.\n");
+		log("        stops at the earliest failing time step and reports its depth, so\n");
+		log("        the counter example is as short as possible.\n");
+		log("\n");
 		log("    -set-at <N> <signal> <value>\n");
 		log("    -unset-at <N> <signal>\n");
 		log("        set or unset the specified signal to the specified value in the\n");
@@ -1093,9 +3918,21 @@ struct SatPass : public Pass {
 		log("    -dump_vcd <vcd-file-name>\n");
 		log("        dump SAT model (counter example in proof) to VCD file\n");
 		log("\n");
+		log("    -dump_fst <fst-file-name>\n");
+		log("        dump SAT model (counter example in proof) to a compressed FST file.\n");
+		log("        only value changes are stored, which keeps long traces small.\n");
+		log("\n");
 		log("    -dump_json <json-file-name>\n");
 		log("        dump SAT model (counter example in proof) to a WaveJSON file.\n");
 		log("\n");
+		log("    -dump_model_bin <file-name>\n");
+		log("        dump SAT model to a packed binary file (name table followed by one\n");
+		log("        record per signal and time step with bit-packed value and undef words).\n");
+		log("\n");
+		log("    -model-format text|json\n");
+		log("        format of the model printed to the log. 'json' prints the whole model as\n");
+		log("        a single line with hex encoded value and undef bits. default: text\n");
+		log("\n");
 		log("    -dump_cnf <cnf-file-name>\n");
 		log("        dump CNF of SAT problem (in DIMACS format). in temporal induction\n");
 		log("        proofs this is the CNF of the first induction step.\n");
@@ -1118,6 +3955,12 @@ struct SatPass : public Pass {
 		log("    -tempinduct-inductonly\n");
 		log("        Run only the induction half of temporal induction\n");
 		log("\n");
+		log("    -tempinduct-lazy-unique\n");
+		log("        Do not add the O(N^2) state uniqueness constraints to the base case and\n");
+		log("        induction step up front. Instead solve without them and, whenever a\n");
+		log("        model visits the same state twice, add the constraints that rule out\n");
+		log("        exactly these repeats and solve again.\n");
+		log("\n");
 		log("    -tempinduct-skip <N>\n");
 		log("        Skip the first <N> steps of the induction proof.\n");
 		log("\n");
@@ -1136,9 +3979,58 @@ struct SatPass : public Pass {
 		log("    -prove-asserts\n");
 		log("        Prove that all asserts in the design hold.\n");
 		log("\n");
+		log("    -prove-each\n");
+		log("        Prove each -prove and -prove-x pair and each assert on its own, in\n");
+		log("        the same solver instance. Proven properties are assumed for the\n");
+		log("        remaining ones, and the result of each property is reported as\n");
+		log("        PASS, FAIL or UNKNOWN (timeout). Failing properties print their own\n");
+		log("        counter example. With the -dump_* options for models it is written\n");
+		log("        to a file per property, named after the given one with the number of\n");
+		log("        the property appended: -dump_vcd cex.vcd gives cex_1.vcd, cex_2.vcd..\n");
+		log("\n");
 		log("    -prove-skip <N>\n");
 		log("        Do not enforce the prove-condition for the first <N> time steps.\n");
 		log("\n");
+		log("    -unsat-core\n");
+		log("        When the result is NO or the proof succeeds, print a minimized set of\n");
+		log("        the -set, -set-at, -set-def (etc.), -set-init, init attribute and assume\n");
+		log("        constraints that is sufficient for this result. Not supported with\n");
+		log("        -tempinduct or -seq-incremental.\n");
+		log("\n");
+		log("    -minimize-cex\n");
+		log("        Reduce a counter example to a small set of input and initial state bits\n");
+		log("        that force the proof to fail. All other input bits are shown as undef.\n");
+		log("        Not supported with -all, -max and -tempinduct.\n");
+		log("\n");
+		log("    -replay\n");
+		log("    -no-replay\n");
+		log("        By default every counter example is replayed on a separate bit-parallel\n");
+		log("        simulator of the selected cells to confirm that the proof condition\n");
+		log("        really fails (not for temporal induction). The simulator is only built\n");
+		log("        once a counter example was found, and designs it does not support are\n");
+		log("        silently skipped unless -replay is given. -no-replay disables it.\n");
+		log("\n");
+		log("    -random-sim <N>\n");
+		log("        Before building the SAT problem, simulate <N> random input patterns\n");
+		log("        over all -seq time steps. Constant -set values and initial values are\n");
+		log("        applied, patterns that violate a -set, -set-at or assume constraint are\n");
+		log("        discarded. If a pattern violates the proof condition, its input values\n");
+		log("        are fixed in the SAT problem, so the solver only has to extract the\n");
+		log("        model of that trace for printing and the -dump_* options. Can't be\n");
+		log("        used with -minimize-cex or -prove-each.\n");
+		log("\n");
+		log("    -pdr\n");
+		log("        Prove the condition for all reachable states using property directed\n");
+		log("        reachability (IC3). This can close proofs that are not k-inductive for\n");
+		log("        any small k. Counter examples are reconstructed with -seq-incremental.\n");
+		log("        -maxsteps limits the number of frames. Undef modeling is not supported.\n");
+		log("\n");
+		log("    -itp\n");
+		log("        Prove the condition for all reachable states using interpolation based\n");
+		log("        model checking. The interpolants are built from generalized state cubes\n");
+		log("        instead of resolution proofs. -maxsteps limits the unrolling bound.\n");
+		log("        Same restrictions as -pdr.\n");
+		log("\n");
 		log("    -maxsteps <N>\n");
 		log("        Set a maximum length for the induction.\n");
 		log("\n");
@@ -1174,15 +4066,20 @@ struct SatPass : public Pass {
 		std::map<int, std::vector<std::pair<std::string, std::string>>> sets_at;
 		std::map<int, std::vector<std::string>> unsets_at, sets_def_at, sets_any_undef_at, sets_all_undef_at;
 		std::vector<std::string> shows, sets_def, sets_any_undef, sets_all_undef;
-		int loopcount = 0, seq_len = 0, maxsteps = 0, initsteps = 0, timeout = 0, prove_skip = 0;
+		int loopcount = 0, seq_len = 0, maxsteps = 0, initsteps = 0, timeout = 0, prove_skip = 0, random_sim = 0;
+		bool replay = true, replay_explicit = false, minimize_cex = false, unsat_core = false, hier = false, prove_each = false;
+		bool engine_cex = false;
+		int threads = 1;
 		bool verify = false, fail_on_timeout = false, enable_undef = false, set_def_inputs = false, set_def_formal = false;
 		bool ignore_div_by_zero = false, set_init_undef = false, set_init_zero = false, max_undef = false;
 		bool tempinduct = false, prove_asserts = false, show_inputs = false, show_outputs = false;
 		bool show_regs = false, show_public = false, show_all = false;
 		bool ignore_unknown_cells = false, falsify = false, tempinduct_def = false, set_init_def = false;
 		bool tempinduct_baseonly = false, tempinduct_inductonly = false, set_assumes = false;
+		bool seq_incremental = false, tempinduct_lazy_unique = false, pdr = false, itp = false;
 		int tempinduct_skip = 0, stepsize = 1;
-		std::string vcd_file_name, json_file_name, cnf_file_name;
+		std::string vcd_file_name, fst_file_name, json_file_name, cnf_file_name, bin_file_name;
+		std::string model_format = "text", session_mode;
 
 		log_header(design, "Executing SAT pass (solving SAT problems in the circuit).\n");
 
@@ -1298,6 +4195,11 @@ struct SatPass : public Pass {
 				tempinduct_inductonly = true;
 				continue;
 			}
+			if (args[argidx] == "-tempinduct-lazy-unique") {
+				tempinduct = true;
+				tempinduct_lazy_unique = true;
+				continue;
+			}
 			if (args[argidx] == "-tempinduct-skip" && argidx+1 < args.size()) {
 				tempinduct_skip = atoi(args[++argidx].c_str());
 				continue;
@@ -1319,14 +4221,64 @@ struct SatPass : public Pass {
 				prove_asserts = true;
 				continue;
 			}
+			if (args[argidx] == "-prove-each") {
+				prove_each = true;
+				continue;
+			}
+			if (args[argidx] == "-pdr") {
+				pdr = true;
+				continue;
+			}
+			if (args[argidx] == "-itp") {
+				itp = true;
+				continue;
+			}
 			if (args[argidx] == "-prove-skip" && argidx+1 < args.size()) {
 				prove_skip = atoi(args[++argidx].c_str());
 				continue;
 			}
+			if (args[argidx] == "-threads" && argidx+1 < args.size()) {
+				threads = max(1, atoi(args[++argidx].c_str()));
+				continue;
+			}
+			if (args[argidx] == "-hier") {
+				hier = true;
+				continue;
+			}
+			if (args[argidx] == "-session" && argidx+1 < args.size()) {
+				session_mode = args[++argidx];
+				if (session_mode != "open" && session_mode != "query" && session_mode != "close")
+					log_cmd_error("Unsupported session mode `%s', expected open, query or close.\n", session_mode.c_str());
+				continue;
+			}
+			if (args[argidx] == "-unsat-core") {
+				unsat_core = true;
+				continue;
+			}
+			if (args[argidx] == "-minimize-cex") {
+				minimize_cex = true;
+				continue;
+			}
+			if (args[argidx] == "-replay") {
+				replay = true, replay_explicit = true;
+				continue;
+			}
+			if (args[argidx] == "-no-replay") {
+				replay = false;
+				continue;
+			}
+			if (args[argidx] == "-random-sim" && argidx+1 < args.size()) {
+				random_sim = atoi(args[++argidx].c_str());
+				continue;
+			}
 			if (args[argidx] == "-seq" && argidx+1 < args.size()) {
 				seq_len = atoi(args[++argidx].c_str());
 				continue;
 			}
+			if (args[argidx] == "-seq-incremental") {
+				seq_incremental = true;
+				continue;
+			}
 			if (args[argidx] == "-set-at" && argidx+3 < args.size()) {
 				int timestep = atoi(args[++argidx].c_str());
 				std::string lhs = args[++argidx];
@@ -1413,6 +4365,20 @@ struct SatPass : public Pass {
 				vcd_file_name = args[++argidx];
 				continue;
 			}
+			if (args[argidx] == "-dump_fst" && argidx+1 < args.size()) {
+				fst_file_name = args[++argidx];
+				continue;
+			}
+			if (args[argidx] == "-dump_model_bin" && argidx+1 < args.size()) {
+				bin_file_name = args[++argidx];
+				continue;
+			}
+			if (args[argidx] == "-model-format" && argidx+1 < args.size()) {
+				model_format = args[++argidx];
+				if (model_format != "text" && model_format != "json")
+					log_cmd_error("Unsupported model format `%s'.\n", model_format.c_str());
+				continue;
+			}
 			if (args[argidx] == "-dump_json" && argidx+1 < args.size()) {
 				json_file_name = args[++argidx];
 				continue;
@@ -1425,8 +4391,167 @@ struct SatPass : public Pass {
 		}
 		extra_args(args, argidx, design);
 
+		if (!session_mode.empty() && (tempinduct || pdr || itp || random_sim || loopcount || max_undef || minimize_cex || unsat_core))
+			log_cmd_error("Option -session can't be used with -tempinduct, -pdr, -itp, -random-sim, -all, -max, -max_undef, -minimize-cex or -unsat-core!\n");
+
+		if (session_mode == "close") {
+			if (find_sat_session(design) == nullptr)
+				log_cmd_error("There is no open SAT session for this design!\n");
+			close_sat_session(design);
+			log("Closed SAT session.\n");
+			return;
+		}
+
+		if (session_mode == "query")
+		{
+			SatSession *session = find_sat_session(design);
+			if (session == nullptr)
+				log_cmd_error("There is no open SAT session for this design!\n");
+			if (sat_session_changed(design, *session))
+				log_cmd_error("Module %s was changed since the SAT session was opened, close the session and open a new one!\n",
+						log_id(session->module_name));
+
+			SatHelper &helper = *session->helper;
+			if (seq_len || shows.size() || show_inputs || show_outputs || show_regs || show_public || show_all ||
+					sets_init.size() || set_init_undef || set_init_zero || set_init_def ||
+					sets_def.size() || sets_any_undef.size() || sets_all_undef.size() ||
+					sets_def_at.size() || sets_any_undef_at.size() || sets_all_undef_at.size() || unsets_at.size() ||
+					set_def_inputs || set_def_formal || ignore_div_by_zero || ignore_unknown_cells || set_assumes ||
+					threads != 1 || hier || !cnf_file_name.empty())
+				log_cmd_error("Options -seq, -show*, -set-init*, -set-def*, -set-any-undef*, -set-all-undef*, -unset-at, -set-assumes,\n"
+						"-ignore_div_by_zero, -ignore_unknown_cells, -threads, -hier and -dump_cnf can only be used with -session open!\n");
+			if (enable_undef && !helper.enable_undef)
+				log_cmd_error("The SAT session was opened without undef modeling, -enable_undef and -prove-x can't be used in a query!\n");
+
+			int session_len = session->seq_len;
+			auto session_prove = helper.prove, session_prove_x = helper.prove_x;
+			bool session_prove_asserts = helper.prove_asserts;
+			int session_timeout = helper.timeout;
+			std::string session_model_format = helper.model_format;
+			if (prove.size() || prove_x.size() || prove_asserts) {
+				helper.prove = prove;
+				helper.prove_x = prove_x;
+				helper.prove_asserts = prove_asserts;
+			}
+			if (timeout)
+				helper.timeout = timeout;
+			if (model_format != "text")
+				helper.model_format = model_format;
+			bool proving = helper.prove.size() || helper.prove_x.size() || helper.prove_asserts;
+
+			std::vector<int> steps;
+			if (session_len == 0)
+				steps.push_back(-1);
+			for (int t = 1; t <= session_len; t++)
+				steps.push_back(t);
+
+			// everything this query adds is retracted again at the end, also on errors
+			std::vector<int> selectors;
+			auto restore = [&]() {
+				for (int sel : selectors)
+					helper.retract(sel);
+				helper.prove = session_prove;
+				helper.prove_x = session_prove_x;
+				helper.prove_asserts = session_prove_asserts;
+				helper.timeout = session_timeout;
+				helper.model_format = session_model_format;
+				helper.gotTimeout = false;
+				helper.show_signal_pool = session->show_signals;
+				helper.model_timestep = -2;
+			};
+
+			enum { QUERY_MODEL, QUERY_NO_MODEL, QUERY_TIMEOUT } result = QUERY_NO_MODEL;
+			try
+			{
+				// a -set-at overrides a -set on the same (sigmapped) bits, as in setup()
+				std::vector<RTLIL::SigSpec> step_lhs(GetSize(steps)), step_rhs(GetSize(steps));
+				for (int si = 0; si < GetSize(steps); si++) {
+					std::vector<std::pair<std::string, std::string>> step_pairs = sets;
+					step_pairs.insert(step_pairs.end(), sets_at[steps[si]].begin(), sets_at[steps[si]].end());
+					for (auto &s : step_pairs) {
+						RTLIL::SigSpec lhs, rhs;
+						helper.parse_set_expr(s.first, s.second, lhs, rhs);
+						lhs = helper.sigmap(lhs);
+						step_lhs[si].remove2(lhs, &step_rhs[si]);
+						step_lhs[si].append(lhs);
+						step_rhs[si].append(rhs);
+					}
+				}
+
+				std::vector<int> prove_bits;
+				for (int si = 0; si < GetSize(steps); si++) {
+					int t = steps[si];
+					if (step_lhs[si].size())
+						selectors.push_back(helper.add_retractable_set(step_lhs[si], step_rhs[si], t));
+					if (proving && (t < 0 || t > prove_skip))
+						prove_bits.push_back(helper.setup_proof(t));
+				}
+				if (proving)
+					selectors.push_back(helper.add_retractable(helper.ez->NOT(helper.ez->expression(ezSAT::OpAnd, prove_bits))));
+				helper.generate_model();
+
+				log_flush();
+				if (helper.solve()) {
+					result = QUERY_MODEL;
+					if (proving) {
+						log("SAT proof finished - model found: FAIL!\n");
+						print_proof_failed();
+					} else
+						log("YES\n");
+					helper.print_model();
+					if (!vcd_file_name.empty())
+						helper.dump_model_to_vcd(vcd_file_name);
+					if (!bin_file_name.empty())
+						helper.dump_model_to_bin(bin_file_name);
+					if (!fst_file_name.empty())
+						helper.dump_model_to_fst(fst_file_name);
+					if (!json_file_name.empty())
+						helper.dump_model_to_json(json_file_name);
+				} else if (helper.gotTimeout) {
+					result = QUERY_TIMEOUT;
+					log("Interrupted SAT solver: TIMEOUT!\n");
+					print_timeout();
+				} else {
+					result = QUERY_NO_MODEL;
+					if (proving) {
+						log("SAT proof finished - no model found: SUCCESS!\n");
+						print_qed();
+					} else
+						log("NO\n");
+				}
+			}
+			catch (...)
+			{
+				restore();
+				throw;
+			}
+			restore();
+
+			if (result == QUERY_TIMEOUT && fail_on_timeout)
+				log_error("Called with -verify and proof did time out!\n");
+			if (result == QUERY_MODEL && proving && verify)
+				log_error("Called with -verify and proof did fail!\n");
+			if (result == QUERY_MODEL && !proving && falsify)
+				log_error("Called with -falsify and found a model!\n");
+			if (result == QUERY_NO_MODEL && proving && falsify)
+				log_error("Called with -falsify and proof did succeed!\n");
+			if (result == QUERY_NO_MODEL && !proving && verify)
+				log_error("Called with -verify and found no model!\n");
+			return;
+		}
+
 		RTLIL::Module *module = NULL;
 		for (auto mod : design->selected_modules()) {
+			// with -hier only the top of the selected hierarchy counts
+			if (hier) {
+				bool instantiated = false;
+				for (auto other : design->selected_modules())
+					for (auto cell : other->cells())
+						if (cell->type == mod->name)
+							instantiated = true;
+				if (instantiated)
+					continue;
+			}
 			if (module)
 				log_cmd_error("Only one module must be selected for the SAT pass! (selected: %s and %s)\n", log_id(module), log_id(mod));
 			module = mod;
@@ -1443,6 +4568,35 @@ struct SatPass : public Pass {
 		if (prove_skip >= seq_len && prove_skip > 0)
 			log_cmd_error("The value of -prove-skip must be smaller than the one of -seq.\n");
 
+		if (seq_incremental && (tempinduct || seq_len == 0 || (!prove.size() && !prove_x.size() && !prove_asserts)))
+			log_cmd_error("Option -seq-incremental requires -seq and something to prove, and can't be used with -tempinduct!\n");
+
+		if (random_sim > 0 && (tempinduct || minimize_cex || prove_each || (!prove.size() && !prove_x.size() && !prove_asserts)))
+			log_cmd_error("Option -random-sim requires something to prove and can't be used with -tempinduct, -minimize-cex or -prove-each!\n");
+
+		if (unsat_core && (tempinduct || seq_incremental))
+			log_cmd_error("Option -unsat-core can't be used with -tempinduct or -seq-incremental!\n");
+
+		if (minimize_cex && (tempinduct || loopcount != 0 || (!prove.size() && !prove_x.size() && !prove_asserts)))
+			log_cmd_error("Option -minimize-cex requires something to prove and can't be used with -tempinduct, -all or -max!\n");
+
+		if (prove_each && (tempinduct || pdr || itp || seq_incremental || loopcount != 0 || max_undef || minimize_cex || unsat_core || !session_mode.empty() ||
+				(!prove.size() && !prove_x.size() && !prove_asserts)))
+			log_cmd_error("Option -prove-each requires something to prove and can't be used with -tempinduct, -pdr, -itp, -seq-incremental,\n"
+					"-all, -max, -max_undef, -minimize-cex, -unsat-core or -session!\n");
+
+		if (pdr && itp)
+			log_cmd_error("Options -pdr and -itp are exclusive!\n");
+
+		if ((pdr || itp) && (tempinduct || seq_len > 0 || (!prove.size() && !prove_x.size() && !prove_asserts)))
+			log_cmd_error("Options -pdr and -itp require something to prove and can't be used with -tempinduct or -seq!\n");
+
+		if ((pdr || itp) && (unsat_core || minimize_cex))
+			log_cmd_error("Options -unsat-core and -minimize-cex are not supported with -pdr or -itp!\n");
+
+		if ((pdr || itp) && (enable_undef || sets_at.size() || unsets_at.size()))
+			log_cmd_error("Options -pdr and -itp do not support undef modeling or time step specific constraints!\n");
+
 		if (set_init_undef + set_init_zero + set_init_def > 1)
 			log_cmd_error("The options -set-init-undef, -set-init-def, and -set-init-zero are exclusive!\n");
 
@@ -1487,6 +4641,120 @@ struct SatPass : public Pass {
 				shows.push_back(wire->name.str());
 		}
 
+		auto setup_helper = [&](SatHelper &helper) {
+			helper.sets = sets;
+			helper.set_assumes = set_assumes;
+			helper.prove = prove;
+			helper.prove_x = prove_x;
+			helper.prove_asserts = prove_asserts;
+			helper.sets_at = sets_at;
+			helper.unsets_at = unsets_at;
+			helper.shows = shows;
+			helper.timeout = timeout;
+			helper.sets_def = sets_def;
+			helper.sets_any_undef = sets_any_undef;
+			helper.sets_all_undef = sets_all_undef;
+			helper.sets_def_at = sets_def_at;
+			helper.sets_any_undef_at = sets_any_undef_at;
+			helper.sets_all_undef_at = sets_all_undef_at;
+			helper.sets_init = sets_init;
+			helper.set_init_def = set_init_def;
+			helper.set_init_undef = set_init_undef;
+			helper.set_init_zero = set_init_zero;
+			helper.satgen.ignore_div_by_zero = ignore_div_by_zero;
+			helper.ignore_unknown_cells = ignore_unknown_cells;
+			helper.model_format = model_format;
+			helper.hier = hier;
+			helper.hier_comb_only = tempinduct || pdr || itp;
+			helper.threads = threads;
+		};
+
+		if (session_mode == "open")
+		{
+			if (find_sat_session(design) != nullptr)
+				log_cmd_error("There is already an open SAT session for this design, close it first!\n");
+
+			// only register the session once the setup went through
+			std::unique_ptr<SatHelper> new_helper(new SatHelper(design, module, enable_undef, set_def_formal));
+			SatHelper &helper = *new_helper;
+			setup_helper(helper);
+
+			if (seq_len == 0)
+				helper.setup();
+			for (int timestep = 1; timestep <= seq_len; timestep++)
+				helper.setup(timestep, timestep == 1);
+			helper.generate_model();
+
+			SatSession &session = sat_sessions[design];
+			session.helper = std::move(new_helper);
+			session.monitor.reset(new SatSessionMonitor(module, hier));
+			design->monitors.insert(session.monitor.get());
+			session.seq_len = seq_len;
+			session.design_hashidx = design->hashidx_;
+			session.module_hashidx = module->hashidx_;
+			session.module_name = module->name;
+			session.num_wires = GetSize(module->wires_);
+			session.num_cells = GetSize(module->cells_);
+			session.num_connections = GetSize(module->connections());
+			session.show_signals = helper.show_signal_pool;
+			design->scratchpad_set_string("sat.session", module->name.str());
+			log("Opened SAT session for module %s (%d variables, %d clauses).\n", log_id(module),
+					helper.ez->numCnfVariables(), helper.ez->numCnfClauses());
+			return;
+		}
+
+		if (pdr || itp)
+		{
+			SatEngineResult result;
+			int cex_depth = 0;
+
+			if (pdr) {
+				SatHelper pdrhelper(design, module, enable_undef, set_def_formal);
+				setup_helper(pdrhelper);
+				SatPdr engine(pdrhelper);
+				result = engine.run(maxsteps);
+				cex_depth = engine.cex_depth;
+			} else {
+				SatHelper imagehelper(design, module, enable_undef, set_def_formal);
+				SatHelper bmchelper(design, module, enable_undef, set_def_formal);
+				setup_helper(imagehelper);
+				setup_helper(bmchelper);
+				SatItp engine(imagehelper, bmchelper);
+				result = engine.run(maxsteps);
+				cex_depth = engine.cex_depth;
+			}
+
+			if (result == ENGINE_TIMEOUT)
+				goto timeout;
+
+			if (result == ENGINE_PROVEN) {
+				log("SAT %s proof finished - no reachable state violates the condition: SUCCESS!\n", pdr ? "PDR" : "ITP");
+				print_qed();
+				if (falsify) {
+					log("\n");
+					log_error("Called with -falsify and proof did succeed!\n");
+				}
+				return;
+			}
+
+			if (result == ENGINE_UNKNOWN) {
+				log("\nReached maximum number of %s -> proof failed.\n", pdr ? "frames" : "unrolling steps");
+				print_proof_failed();
+				if (verify) {
+					log("\n");
+					log_error("Called with -verify and proof did fail!\n");
+				}
+				return;
+			}
+
+			log("%s found a counter example of at most %d time steps, reconstructing it with -seq %d -seq-incremental.\n",
+					pdr ? "PDR" : "ITP", cex_depth, cex_depth);
+			seq_len = cex_depth;
+			seq_incremental = true;
+			engine_cex = true;
+			maxsteps = 0;
+		}
+
 		if (tempinduct)
 		{
 			if (loopcount > 0 || max_undef)
@@ -1495,44 +4763,25 @@ struct SatPass : public Pass {
 			SatHelper basecase(design, module, enable_undef, set_def_formal);
 			SatHelper inductstep(design, module, enable_undef, set_def_formal);
 
-			basecase.sets = sets;
-			basecase.set_assumes = set_assumes;
-			basecase.prove = prove;
-			basecase.prove_x = prove_x;
-			basecase.prove_asserts = prove_asserts;
-			basecase.sets_at = sets_at;
-			basecase.unsets_at = unsets_at;
-			basecase.shows = shows;
-			basecase.timeout = timeout;
-			basecase.sets_def = sets_def;
-			basecase.sets_any_undef = sets_any_undef;
-			basecase.sets_all_undef = sets_all_undef;
-			basecase.sets_def_at = sets_def_at;
-			basecase.sets_any_undef_at = sets_any_undef_at;
-			basecase.sets_all_undef_at = sets_all_undef_at;
-			basecase.sets_init = sets_init;
-			basecase.set_init_def = set_init_def;
-			basecase.set_init_undef = set_init_undef;
-			basecase.set_init_zero = set_init_zero;
-			basecase.satgen.ignore_div_by_zero = ignore_div_by_zero;
-			basecase.ignore_unknown_cells = ignore_unknown_cells;
+			setup_helper(basecase);
+			basecase.lazy_model = true;
 
 			for (int timestep = 1; timestep <= seq_len; timestep++)
 				if (!tempinduct_inductonly)
 					basecase.setup(timestep, timestep == 1);
 
-			inductstep.sets = sets;
-			inductstep.set_assumes = set_assumes;
-			inductstep.prove = prove;
-			inductstep.prove_x = prove_x;
-			inductstep.prove_asserts = prove_asserts;
-			inductstep.shows = shows;
-			inductstep.timeout = timeout;
-			inductstep.sets_def = sets_def;
-			inductstep.sets_any_undef = sets_any_undef;
-			inductstep.sets_all_undef = sets_all_undef;
-			inductstep.satgen.ignore_div_by_zero = ignore_div_by_zero;
-			inductstep.ignore_unknown_cells = ignore_unknown_cells;
+			// the induction step starts in an arbitrary state, so it gets no constraints on
+			// absolute time steps or on the initial state
+			setup_helper(inductstep);
+			inductstep.sets_at.clear();
+			inductstep.unsets_at.clear();
+			inductstep.sets_def_at.clear();
+			inductstep.sets_any_undef_at.clear();
+			inductstep.sets_all_undef_at.clear();
+			inductstep.sets_init.clear();
+			inductstep.set_init_def = false;
+			inductstep.set_init_undef = false;
+			inductstep.set_init_zero = false;
 
 			if (!tempinduct_baseonly) {
 				inductstep.setup(1);
@@ -1544,6 +4793,10 @@ struct SatPass : public Pass {
 				inductstep.ez->assume(inductstep.ez->NOT(inductstep.ez->expression(ezSAT::OpOr, undef_state)));
 			}
 
+			// properties of lengths skipped by -tempinduct-skip, -initsteps or -stepsize,
+			// assumed as one conjunction right before the next length that is solved
+			std::vector<int> basecase_skipped, inductstep_skipped;
+
 			for (int inductlen = 1; inductlen <= maxsteps || maxsteps == 0; inductlen++)
 			{
 				log("\n** Trying induction with length %d **\n", inductlen);
@@ -1554,23 +4807,34 @@ struct SatPass : public Pass {
 				{
 					basecase.setup(seq_len + inductlen, seq_len + inductlen == 1);
 					int property = basecase.setup_proof(seq_len + inductlen);
-					basecase.generate_model();
 
-					if (inductlen > 1)
+					if (inductlen > 1 && !tempinduct_lazy_unique)
 						basecase.force_unique_state(seq_len + 1, seq_len + inductlen);
 
 					if (tempinduct_skip < inductlen)
 					{
+						if (!basecase_skipped.empty()) {
+							basecase.ez->assume(basecase.ez->expression(ezSAT::OpAnd, basecase_skipped));
+							basecase_skipped.clear();
+						}
 						//log("\n[base case %d] Solving problem with %d variables and %d clauses..\n",
 								//inductlen, basecase.ez->numCnfVariables(), basecase.ez->numCnfClauses());
 						log_flush();
 
-						if (basecase.solve(basecase.ez->NOT(property))) {
+						bool base_failed = tempinduct_lazy_unique ?
+								basecase.solve_lazy_unique(basecase.ez->NOT(property), seq_len + 1, seq_len + inductlen) :
+								basecase.solve(basecase.ez->NOT(property));
+
+						if (base_failed) {
 							log("SAT temporal induction proof finished - model found for base case: FAIL!\n");
 							print_proof_failed();
 							basecase.print_model();
 							if(!vcd_file_name.empty())
 								basecase.dump_model_to_vcd(vcd_file_name);
+							if(!bin_file_name.empty())
+								basecase.dump_model_to_bin(bin_file_name);
+							if(!fst_file_name.empty())
+								basecase.dump_model_to_fst(fst_file_name);
 							if(!json_file_name.empty())
 								basecase.dump_model_to_json(json_file_name);
 							goto tip_failed;
@@ -1580,6 +4844,7 @@ struct SatPass : public Pass {
 							goto timeout;
 
 						log("Base case for induction length %d proven.\n", inductlen);
+						basecase.ez->assume(property);
 					}
 					else
 					{
@@ -1587,8 +4852,8 @@ struct SatPass : public Pass {
 								inductlen, tempinduct_skip);
 						log("\n[base case %d] Problem size so far: %d variables and %d clauses.\n",
 								inductlen, basecase.ez->numCnfVariables(), basecase.ez->numCnfClauses());
+						basecase_skipped.push_back(property);
 					}
-					basecase.ez->assume(property);
 				}
 
 				// phase 2: proving induction step
@@ -1597,9 +4862,8 @@ struct SatPass : public Pass {
 				{
 					inductstep.setup(inductlen + 1);
 					int property = inductstep.setup_proof(inductlen + 1);
-					inductstep.generate_model();
 
-					if (inductlen > 1)
+					if (inductlen > 1 && !tempinduct_lazy_unique)
 						inductstep.force_unique_state(1, inductlen + 1);
 
 					if (inductlen <= tempinduct_skip || inductlen <= initsteps || inductlen % stepsize != 0)
@@ -1615,10 +4879,16 @@ struct SatPass : public Pass {
 									inductlen, stepsize);
 						log("\n[induction step %d] Problem size so far: %d variables and %d clauses.\n",
 								inductlen, inductstep.ez->numCnfVariables(), inductstep.ez->numCnfClauses());
-						inductstep.ez->assume(property);
+						inductstep_skipped.push_back(property);
 					}
 					else
 					{
+						if (!inductstep_skipped.empty()) {
+							inductstep.ez->assume(inductstep.ez->expression(ezSAT::OpAnd, inductstep_skipped));
+							inductstep_skipped.clear();
+						}
+						inductstep.generate_model();
+
 						if (!cnf_file_name.empty())
 						{
 							rewrite_filename(cnf_file_name);
@@ -1637,7 +4907,11 @@ struct SatPass : public Pass {
 								//inductlen, inductstep.ez->numCnfVariables(), inductstep.ez->numCnfClauses());
 						log_flush();
 
-						if (!inductstep.solve(inductstep.ez->NOT(property))) {
+						bool step_failed = tempinduct_lazy_unique ?
+								inductstep.solve_lazy_unique(inductstep.ez->NOT(property), 1, inductlen + 1) :
+								inductstep.solve(inductstep.ez->NOT(property));
+
+						if (!step_failed) {
 							if (inductstep.gotTimeout)
 								goto timeout;
 							log("Induction step proven: SUCCESS!\n");
@@ -1660,6 +4934,10 @@ struct SatPass : public Pass {
 			log("\nReached maximum number of time steps -> proof failed.\n");
 			if(!vcd_file_name.empty())
 				inductstep.dump_model_to_vcd(vcd_file_name);
+			if(!bin_file_name.empty())
+				inductstep.dump_model_to_bin(bin_file_name);
+			if(!fst_file_name.empty())
+				inductstep.dump_model_to_fst(fst_file_name);
 			if(!json_file_name.empty())
 				inductstep.dump_model_to_json(json_file_name);
 			print_proof_failed();
@@ -1684,32 +4962,115 @@ struct SatPass : public Pass {
 
 			SatHelper sathelper(design, module, enable_undef, set_def_formal);
 
-			sathelper.sets = sets;
-			sathelper.set_assumes = set_assumes;
-			sathelper.prove = prove;
-			sathelper.prove_x = prove_x;
-			sathelper.prove_asserts = prove_asserts;
-			sathelper.sets_at = sets_at;
-			sathelper.unsets_at = unsets_at;
-			sathelper.shows = shows;
-			sathelper.timeout = timeout;
-			sathelper.sets_def = sets_def;
-			sathelper.sets_any_undef = sets_any_undef;
-			sathelper.sets_all_undef = sets_all_undef;
-			sathelper.sets_def_at = sets_def_at;
-			sathelper.sets_any_undef_at = sets_any_undef_at;
-			sathelper.sets_all_undef_at = sets_all_undef_at;
-			sathelper.sets_init = sets_init;
-			sathelper.set_init_def = set_init_def;
-			sathelper.set_init_undef = set_init_undef;
-			sathelper.set_init_zero = set_init_zero;
-			sathelper.satgen.ignore_div_by_zero = ignore_div_by_zero;
-			sathelper.ignore_unknown_cells = ignore_unknown_cells;
+			setup_helper(sathelper);
+			sathelper.minimize = minimize_cex;
+			sathelper.track_core = unsat_core;
+
+			// a counter example from random simulation is fixed in the solver below, the
+			// unrolling is then done in one go as the failing depth doesn't matter anymore
+			bool random_cex = random_sim > 0 && sathelper.random_simulation(random_sim, seq_len, prove_skip);
+			if (random_cex)
+				seq_incremental = false;
+
+			if (prove_each)
+			{
+				// one literal per property, AND-ed over the proven time steps
+				std::vector<std::string> names;
+				std::vector<std::vector<int>> property_bits;
+				std::vector<int> lits;
+				int first_step = seq_len == 0 ? -1 : 1, last_step = seq_len == 0 ? -1 : seq_len;
+				for (int timestep = first_step; timestep <= last_step; timestep++) {
+					if (seq_len == 0)
+						sathelper.setup();
+					else
+						sathelper.setup(timestep, timestep == 1);
+					if (timestep > 0 && timestep <= prove_skip)
+						continue;
+					sathelper.setup_properties(timestep, lits, names.empty() ? &names : nullptr);
+					property_bits.resize(GetSize(lits));
+					for (int i = 0; i < GetSize(lits); i++)
+						property_bits[i].push_back(lits[i]);
+				}
+				sathelper.generate_model();
+
+				if (names.empty()) {
+					log("\nNo properties to prove.\n");
+					return;
+				}
+
+				std::vector<int> properties;
+				for (auto &bits : property_bits)
+					properties.push_back(sathelper.ez->expression(ezSAT::OpAnd, bits));
+				// the model of each failing property goes to its own file, with the number
+				// of the property inserted before the extension: cex.vcd -> cex_2.vcd
+				auto property_file_name = [&](const std::string &file_name, int index) {
+					size_t dot = file_name.rfind('.'), slash = file_name.find_last_of("/\\");
+					if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+						dot = file_name.size();
+					return file_name.substr(0, dot) + stringf("_%d", index + 1) + file_name.substr(dot);
+				};
+				std::vector<int> status = sathelper.prove_each(names, properties, [&](int index) {
+					if (!vcd_file_name.empty())
+						sathelper.dump_model_to_vcd(property_file_name(vcd_file_name, index));
+					if (!fst_file_name.empty())
+						sathelper.dump_model_to_fst(property_file_name(fst_file_name, index));
+					if (!json_file_name.empty())
+						sathelper.dump_model_to_json(property_file_name(json_file_name, index));
+					if (!bin_file_name.empty())
+						sathelper.dump_model_to_bin(property_file_name(bin_file_name, index));
+				});
+
+				int count[3] = {0, 0, 0};
+				log("\nResults of %d properties:\n", GetSize(names));
+				for (int i = 0; i < GetSize(names); i++) {
+					log("  %-7s %s\n", status[i] == 0 ? "PASS" : status[i] == 1 ? "FAIL" : "UNKNOWN", names[i].c_str());
+					count[status[i]]++;
+				}
+				log("%d passed, %d failed, %d unknown.\n", count[0], count[1], count[2]);
+
+				if (count[1] && verify) {
+					log("\n");
+					log_error("Called with -verify and proof did fail!\n");
+				}
+				if (count[2] && fail_on_timeout) {
+					log("\n");
+					log_error("Called with -verify and proof did time out!\n");
+				}
+				if (!count[1] && !count[2] && falsify) {
+					log("\n");
+					log_error("Called with -falsify and proof did succeed!\n");
+				}
+				return;
+			}
 
 			if (seq_len == 0) {
 				sathelper.setup();
 				if (sathelper.prove.size() || sathelper.prove_x.size() || sathelper.prove_asserts)
-					sathelper.ez->assume(sathelper.ez->NOT(sathelper.setup_proof()));
+					sathelper.assume_failure(sathelper.setup_proof());
+			} else if (seq_incremental) {
+				// check each time step under an assumption and keep the proven ones as
+				// permanent facts, so the solver is reused across depths. if a time step
+				// fails we stop unrolling there and the model below is the shortest one.
+				std::vector<int> prove_bits;
+				for (int timestep = 1; timestep <= seq_len; timestep++) {
+					sathelper.setup(timestep, timestep == 1);
+					if (timestep <= prove_skip)
+						continue;
+					int property = sathelper.setup_proof(timestep);
+					prove_bits.push_back(property);
+					log_flush();
+					if (sathelper.solve(sathelper.ez->NOT(property))) {
+						log("Proof fails at time step %d (earliest failing time step).\n", timestep);
+						break;
+					}
+					if (sathelper.gotTimeout)
+						goto timeout;
+					log("Proof holds at time step %d.\n", timestep);
+					sathelper.ez->assume(property);
+				}
+				// either only the failing time step is unproven, or all bits are assumed
+				// already and the final solve below is trivially unsatisfiable
+				sathelper.assume_failure(sathelper.ez->expression(ezSAT::OpAnd, prove_bits));
 			} else {
 				std::vector<int> prove_bits;
 				for (int timestep = 1; timestep <= seq_len; timestep++) {
@@ -1719,8 +5080,10 @@ struct SatPass : public Pass {
 							prove_bits.push_back(sathelper.setup_proof(timestep));
 				}
 				if (sathelper.prove.size() || sathelper.prove_x.size() || sathelper.prove_asserts)
-					sathelper.ez->assume(sathelper.ez->NOT(sathelper.ez->expression(ezSAT::OpAnd, prove_bits)));
+					sathelper.assume_failure(sathelper.ez->expression(ezSAT::OpAnd, prove_bits));
 			}
+			if (random_cex)
+				sathelper.assume_random_cex();
 			sathelper.generate_model();
 
 			if (!cnf_file_name.empty())
@@ -1751,6 +5114,9 @@ struct SatPass : public Pass {
 					sathelper.maximize_undefs();
 				}
 
+				if (minimize_cex)
+					sathelper.minimize_cex();
+
 				if (!prove.size() && !prove_x.size() && !prove_asserts) {
 					//log("SAT solving finished - model found:\n");
 					log("YES\n");
@@ -1762,8 +5128,15 @@ struct SatPass : public Pass {
 
 				sathelper.print_model();
 
+				if (replay && (prove.size() || prove_x.size() || prove_asserts))
+					sathelper.replay_counterexample(prove_skip, replay_explicit);
+
 				if(!vcd_file_name.empty())
 					sathelper.dump_model_to_vcd(vcd_file_name);
+				if(!bin_file_name.empty())
+					sathelper.dump_model_to_bin(bin_file_name);
+				if(!fst_file_name.empty())
+					sathelper.dump_model_to_fst(fst_file_name);
 				if(!json_file_name.empty())
 					sathelper.dump_model_to_json(json_file_name);
 
@@ -1794,12 +5167,20 @@ struct SatPass : public Pass {
 				else if (!prove.size() && !prove_x.size() && !prove_asserts) {
 					//log("SAT solving finished - no model found.\n");
 					log("NO\n");
+					if (unsat_core)
+						sathelper.print_unsat_core();
 					if (verify) {
 						log("\n");
 						log_error("Called with -verify and found no model!\n");
 					}
 				} else {
+					if (engine_cex)
+						log_error("The %s counter example could not be reconstructed within %d time steps!\n", pdr ? "PDR" : "ITP", seq_len);
+					if (random_cex)
+						log_error("The counter example from random simulation could not be reproduced by the SAT solver!\n");
 					log("SAT proof finished - no model found: SUCCESS!\n");
+					if (unsat_core)
+						sathelper.print_unsat_core();
 					print_qed();
 					if (falsify) {
 						log("\n");